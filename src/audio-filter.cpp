@@ -7,6 +7,9 @@
 
 #include <websocket.hpp>
 
+#include <cmath>
+#include <new>
+
 typedef struct {
 	float percent;
 	float db;
@@ -17,6 +20,8 @@ static const volume_map_t volume_curve[] = {{0, -100.0f}, {1, -39.5f},  {5, -38.
 					    {80, -8.0f},  {90, -4.0f},  {100, 0.0f}};
 #define VOLUME_CURVE_SIZE (sizeof(volume_curve) / sizeof(volume_map_t))
 
+#define STALE_FADE_MS 500
+
 const char *filter_get_name(void *)
 {
 	return obs_module_text("WaveLinkSync.FilterName");
@@ -36,13 +41,47 @@ bool update_visibility_states_callback(void *data, obs_properties_t *props, obs_
 
 	auto filter = (filter_t *)data;
 
-	obs_property_set_visible(obs_properties_get(props, "channel_mixer_mute_type"), filter->follow_channel_mute);
-	obs_property_set_visible(obs_properties_get(props, "apply_mixer_volume_type"), filter->apply_mixer_volume);
-	obs_property_set_visible(obs_properties_get(props, "follow_mixer_mute_type"), filter->follow_mixer_mute);
+	obs_property_set_visible(obs_properties_get(props, "channel_mixer_mute_id"), filter->follow_channel_mute);
+	obs_property_set_visible(obs_properties_get(props, "apply_mixer_volume_id"), filter->apply_mixer_volume);
+	obs_property_set_visible(obs_properties_get(props, "follow_mixer_mute_id"), filter->follow_mixer_mute);
 
 	return true;
 }
 
+void add_mixer_list_items(obs_property_t *list, bool include_either)
+{
+	for (int i = MixerType::LOCAL; i < WebSocketHandler::getMixerCount(); i++) {
+		Mixer *mixer = WebSocketHandler::getOutput(static_cast<MixerType>(i));
+		obs_property_list_add_string(list, mixer->name.c_str(), mixer->id.c_str());
+	}
+
+	if (include_either)
+		obs_property_list_add_string(list, "Either", MIXER_ID_EITHER);
+}
+
+// Settings from before mixers were saved by ID hold a MixerType under type_key. Only LOCAL, STREAM and EITHER
+// meant the same mixer in every session, anything above was an index into that session's mixer table.
+void migrate_mixer_setting(obs_data_t *settings, const char *type_key, const char *id_key)
+{
+	if (!obs_data_has_user_value(settings, type_key))
+		return;
+
+	if (!obs_data_has_user_value(settings, id_key)) {
+		long long type = obs_data_get_int(settings, type_key);
+
+		if (type == MixerType::LOCAL || type == MixerType::STREAM) {
+			obs_data_set_string(settings, id_key,
+					    WebSocketHandler::getMixerID(static_cast<MixerType>(type)).c_str());
+		} else if (type == MixerType::EITHER) {
+			obs_data_set_string(settings, id_key, MIXER_ID_EITHER);
+		} else {
+			obs_log(LOG_WARNING, "Can't tell which mixer %s %lld was, using the default", type_key, type);
+		}
+	}
+
+	obs_data_erase(settings, type_key);
+}
+
 obs_properties_t *filter_get_properties(void *data)
 {
 	obs_log(LOG_DEBUG, "+filter_get_properties(...)");
@@ -53,15 +92,14 @@ obs_properties_t *filter_get_properties(void *data)
 							       OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_STRING);
 	obs_property_list_add_string(channel_list, "None", "None");
 
-	for (auto channel : WebSocketHandler::getChannels()) {
-		obs_property_list_add_string(channel_list, channel->name.c_str(), channel->identifier.c_str());
+	for (auto &channel : WebSocketHandler::getChannels()) {
+		obs_property_list_add_string(channel_list, channel.name.c_str(), channel.identifier.c_str());
 	}
 
 	obs_property_t *volume_mixer_list = obs_properties_add_list(
-		props, "volume_mixer_type", obs_module_text("WaveLinkSync.VolumeMixerSelection"), OBS_COMBO_TYPE_LIST,
-		OBS_COMBO_FORMAT_INT);
-	obs_property_list_add_int(volume_mixer_list, "Monitor Mix", 1);
-	obs_property_list_add_int(volume_mixer_list, "Stream Mix", 2);
+		props, "volume_mixer_id", obs_module_text("WaveLinkSync.VolumeMixerSelection"), OBS_COMBO_TYPE_LIST,
+		OBS_COMBO_FORMAT_STRING);
+	add_mixer_list_items(volume_mixer_list, false);
 
 	obs_property_set_long_description(volume_mixer_list,
 					  obs_module_text("WaveLinkSync.VolumeMixerSelection.Description"));
@@ -74,12 +112,10 @@ obs_properties_t *filter_get_properties(void *data)
 
 	obs_property_set_modified_callback2(follow_channel_mute, update_visibility_states_callback, data);
 
-	obs_property_t *muted_mixer_list = obs_properties_add_list(props, "channel_mixer_mute_type",
+	obs_property_t *muted_mixer_list = obs_properties_add_list(props, "channel_mixer_mute_id",
 								   obs_module_text("WaveLinkSync.MutedMixerSelection"),
-								   OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
-	obs_property_list_add_int(muted_mixer_list, "Monitor Mix", 1);
-	obs_property_list_add_int(muted_mixer_list, "Stream Mix", 2);
-	obs_property_list_add_int(muted_mixer_list, "Either", 100);
+								   OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_STRING);
+	add_mixer_list_items(muted_mixer_list, true);
 
 	obs_property_set_long_description(muted_mixer_list,
 					  obs_module_text("WaveLinkSync.MutedMixerSelection.Description"));
@@ -93,10 +129,9 @@ obs_properties_t *filter_get_properties(void *data)
 	obs_property_set_modified_callback2(apply_mixer_volume, update_visibility_states_callback, data);
 
 	obs_property_t *apply_mixer_volume_list = obs_properties_add_list(
-		props, "apply_mixer_volume_type", obs_module_text("WaveLinkSync.ApplyMixerVolumeSelection"),
-		OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
-	obs_property_list_add_int(apply_mixer_volume_list, "Monitor Mix", 1);
-	obs_property_list_add_int(apply_mixer_volume_list, "Stream Mix", 2);
+		props, "apply_mixer_volume_id", obs_module_text("WaveLinkSync.ApplyMixerVolumeSelection"),
+		OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_STRING);
+	add_mixer_list_items(apply_mixer_volume_list, false);
 
 	obs_property_set_long_description(apply_mixer_volume_list,
 					  obs_module_text("WaveLinkSync.ApplyMixerVolumeSelection.Description"));
@@ -110,15 +145,33 @@ obs_properties_t *filter_get_properties(void *data)
 	obs_property_set_modified_callback2(follow_mixer_mute, update_visibility_states_callback, data);
 
 	obs_property_t *follow_mixer_mute_list = obs_properties_add_list(
-		props, "follow_mixer_mute_type", obs_module_text("WaveLinkSync.FollowMixerMuteSelection"),
-		OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
-	obs_property_list_add_int(follow_mixer_mute_list, "Monitor Mix", 1);
-	obs_property_list_add_int(follow_mixer_mute_list, "Stream Mix", 2);
-	obs_property_list_add_int(follow_mixer_mute_list, "Either", 100);
+		props, "follow_mixer_mute_id", obs_module_text("WaveLinkSync.FollowMixerMuteSelection"),
+		OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_STRING);
+	add_mixer_list_items(follow_mixer_mute_list, true);
 
 	obs_property_set_long_description(follow_mixer_mute_list,
 					  obs_module_text("WaveLinkSync.FollowMixerMuteSelection.Description"));
 
+	// Stale state handling
+	obs_property_t *stale_state_policy_list = obs_properties_add_list(
+		props, "stale_state_policy", obs_module_text("WaveLinkSync.StaleStatePolicy"), OBS_COMBO_TYPE_LIST,
+		OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(stale_state_policy_list, obs_module_text("WaveLinkSync.StaleStatePolicy.Hold"),
+				  StaleStatePolicy::HOLD);
+	obs_property_list_add_int(stale_state_policy_list, obs_module_text("WaveLinkSync.StaleStatePolicy.FadeOut"),
+				  StaleStatePolicy::FADE_OUT);
+	obs_property_list_add_int(stale_state_policy_list, obs_module_text("WaveLinkSync.StaleStatePolicy.Mute"),
+				  StaleStatePolicy::MUTE);
+
+	obs_property_set_long_description(stale_state_policy_list,
+					  obs_module_text("WaveLinkSync.StaleStatePolicy.Description"));
+
+	// Push OBS volume and mute to Wave Link
+	obs_property_t *push_obs_changes = obs_properties_add_bool(props, "push_obs_changes",
+								    obs_module_text("WaveLinkSync.PushObsChanges"));
+	obs_property_set_long_description(push_obs_changes,
+					  obs_module_text("WaveLinkSync.PushObsChanges.Description"));
+
 	// Refresh button
 	obs_properties_add_text(props, "refresh_button_text", obs_module_text("WaveLinkSync.RefreshButton.Description"),
 				OBS_TEXT_INFO);
@@ -137,17 +190,23 @@ void filter_get_defaults(obs_data_t *defaults)
 {
 	obs_log(LOG_DEBUG, "+filter_get_defaults(...)");
 
+	const char *local_mixer_id = WebSocketHandler::getMixerID(MixerType::LOCAL).c_str();
+
 	obs_data_set_default_string(defaults, "channel", "None");
-	obs_data_set_default_int(defaults, "volume_mixer_type", 1);
+	obs_data_set_default_string(defaults, "volume_mixer_id", local_mixer_id);
 
 	obs_data_set_default_bool(defaults, "follow_channel_mute", true);
-	obs_data_set_default_int(defaults, "channel_mixer_mute_type", 1);
+	obs_data_set_default_string(defaults, "channel_mixer_mute_id", local_mixer_id);
 
 	obs_data_set_default_bool(defaults, "apply_mixer_volume", true);
-	obs_data_set_default_int(defaults, "apply_mixer_volume_type", 1);
+	obs_data_set_default_string(defaults, "apply_mixer_volume_id", local_mixer_id);
 
 	obs_data_set_default_bool(defaults, "follow_mixer_mute", true);
-	obs_data_set_default_int(defaults, "follow_mixer_mute_type", 1);
+	obs_data_set_default_string(defaults, "follow_mixer_mute_id", local_mixer_id);
+
+	obs_data_set_default_int(defaults, "stale_state_policy", StaleStatePolicy::HOLD);
+
+	obs_data_set_default_bool(defaults, "push_obs_changes", false);
 
 	obs_log(LOG_DEBUG, "-filter_get_defaults(...)");
 }
@@ -158,52 +217,160 @@ void filter_update(void *data, obs_data_t *settings)
 
 	auto filter = (filter_t *)data;
 	filter->channels = audio_output_get_channels(obs_get_audio());
+	filter->sample_rate = audio_output_get_sample_rate(obs_get_audio());
+
+	migrate_mixer_setting(settings, "volume_mixer_type", "volume_mixer_id");
+	migrate_mixer_setting(settings, "channel_mixer_mute_type", "channel_mixer_mute_id");
+	migrate_mixer_setting(settings, "apply_mixer_volume_type", "apply_mixer_volume_id");
+	migrate_mixer_setting(settings, "follow_mixer_mute_type", "follow_mixer_mute_id");
 
 	auto channel = obs_data_get_string(settings, "channel");
-	auto volume_mixer_type = (int)obs_data_get_int(settings, "volume_mixer_type");
+	auto volume_mixer_id = obs_data_get_string(settings, "volume_mixer_id");
 
 	auto follow_channel_mute = obs_data_get_bool(settings, "follow_channel_mute");
-	auto channel_mixer_mute_type = (int)obs_data_get_int(settings, "channel_mixer_mute_type");
+	auto channel_mixer_mute_id = obs_data_get_string(settings, "channel_mixer_mute_id");
 
 	auto apply_mixer_volume = obs_data_get_bool(settings, "apply_mixer_volume");
-	auto apply_mixer_volume_type = (int)obs_data_get_int(settings, "apply_mixer_volume_type");
+	auto apply_mixer_volume_id = obs_data_get_string(settings, "apply_mixer_volume_id");
 
 	auto follow_mixer_mute = obs_data_get_bool(settings, "follow_mixer_mute");
-	auto follow_mixer_mute_type = (int)obs_data_get_int(settings, "follow_mixer_mute_type");
+	auto follow_mixer_mute_id = obs_data_get_string(settings, "follow_mixer_mute_id");
+
+	auto stale_state_policy = (int)obs_data_get_int(settings, "stale_state_policy");
+
+	auto push_obs_changes = obs_data_get_bool(settings, "push_obs_changes");
 
 	filter->channel = std::string(channel);
-	filter->volume_mixer_type = volume_mixer_type;
 
 	filter->follow_channel_mute = follow_channel_mute;
-	filter->channel_mixer_mute_type = channel_mixer_mute_type;
-
 	filter->apply_mixer_volume = apply_mixer_volume;
-	filter->apply_mixer_volume_type = apply_mixer_volume_type;
-
 	filter->follow_mixer_mute = follow_mixer_mute;
-	filter->follow_mixer_mute_type = follow_mixer_mute_type;
+
+	WebSocketHandler::setFilterMixerIDs(filter, volume_mixer_id, channel_mixer_mute_id, apply_mixer_volume_id,
+					    follow_mixer_mute_id);
+
+	filter->stale_state_policy = stale_state_policy;
+
+	filter->push_obs_changes = push_obs_changes;
+
+	// Wave Link's side wins when pushing is switched on, the fader takes over the channel volume from the gain
+	WebSocketHandler::syncFilterParent(filter);
+
+	SharedState::setFilterInfo(filter->shared_state_slot,
+				   filter->parent ? obs_source_get_name(filter->parent) : "", filter->channel);
 
 	obs_log(LOG_DEBUG, "-filter_update");
 }
 
+// Scripts can call this through the filter's proc handler, peak and rms are in dB
+void proc_get_levels(void *data, calldata_t *calldata)
+{
+	auto filter = (filter_t *)data;
+	long long channel = calldata_int(calldata, "channel");
+
+	float peak = 0.0f;
+	float rms = 0.0f;
+
+	if (channel >= 0 && (size_t)channel < filter->channels) {
+		peak = filter->level_peak[channel].load(std::memory_order_relaxed);
+		rms = filter->level_rms[channel].load(std::memory_order_relaxed);
+	}
+
+	calldata_set_float(calldata, "peak", obs_mul_to_db(peak));
+	calldata_set_float(calldata, "rms", obs_mul_to_db(rms));
+}
+
 void *filter_create(obs_data_t *settings, obs_source_t *obs_source)
 {
 	obs_log(LOG_DEBUG, "+filter_create");
 
-	auto filter = (filter_t *)bzalloc(sizeof(filter_t));
+	// filter_t holds C++ members (strings, atomics), so it has to be constructed, not just zeroed
+	auto filter = new (bzalloc(sizeof(filter_t))) filter_t();
 	filter->context = obs_source;
+	filter->stale_fade = 1.0f;
+	filter->channel_volume = 100;
+	filter->shared_state_slot = SharedState::acquireFilterSlot();
+	WebSocketHandler::registerFilter(filter);
 	filter_update(filter, settings);
 
+	proc_handler_t *proc_handler = obs_source_get_proc_handler(obs_source);
+	if (proc_handler) {
+		proc_handler_add(proc_handler, "void get_levels(in int channel, out float peak, out float rms)",
+				 proc_get_levels, filter);
+	}
+
 	obs_log(LOG_DEBUG, "-filter_create(...)");
 
 	return filter;
 }
 
+float interpolate_volume_percent(float db);
+
+void on_parent_volume_changed(void *data, calldata_t *calldata)
+{
+	auto filter = (filter_t *)data;
+	if (!filter->push_obs_changes || filter->channel == "None" || WebSocketHandler::isApplyingToParent())
+		return;
+
+	float volume = (float)calldata_float(calldata, "volume");
+	int percent = (int)roundf(interpolate_volume_percent(obs_mul_to_db(volume)));
+
+	WebSocketHandler::queueInputVolume(filter->channel, static_cast<MixerType>(filter->volume_mixer_type), percent);
+}
+
+void on_parent_mute_changed(void *data, calldata_t *calldata)
+{
+	auto filter = (filter_t *)data;
+	if (!filter->push_obs_changes || filter->channel == "None" || WebSocketHandler::isApplyingToParent())
+		return;
+
+	bool muted = calldata_bool(calldata, "muted");
+
+	WebSocketHandler::queueInputMute(filter->channel, static_cast<MixerType>(filter->channel_mixer_mute_type),
+					 muted);
+}
+
+void disconnect_parent_signals(filter_t *filter)
+{
+	if (!filter->parent)
+		return;
+
+	signal_handler_t *handler = obs_source_get_signal_handler(filter->parent);
+	signal_handler_disconnect(handler, "volume", on_parent_volume_changed, filter);
+	signal_handler_disconnect(handler, "mute", on_parent_mute_changed, filter);
+
+	filter->parent = nullptr;
+}
+
+void filter_add(void *data, obs_source_t *source)
+{
+	auto filter = (filter_t *)data;
+	disconnect_parent_signals(filter);
+
+	signal_handler_t *handler = obs_source_get_signal_handler(source);
+	signal_handler_connect(handler, "volume", on_parent_volume_changed, filter);
+	signal_handler_connect(handler, "mute", on_parent_mute_changed, filter);
+
+	filter->parent = source;
+	WebSocketHandler::syncFilterParent(filter);
+
+	SharedState::setFilterInfo(filter->shared_state_slot, obs_source_get_name(source), filter->channel);
+}
+
+void filter_remove(void *data, obs_source_t *)
+{
+	disconnect_parent_signals((filter_t *)data);
+}
+
 void filter_destroy(void *data)
 {
 	obs_log(LOG_DEBUG, "+filter_destroy");
 
 	auto filter = (filter_t *)data;
+	disconnect_parent_signals(filter);
+	WebSocketHandler::unregisterFilter(filter);
+	SharedState::releaseFilterSlot(filter->shared_state_slot);
+	filter->~filter_t();
 	bfree(filter);
 
 	obs_log(LOG_DEBUG, "-filter_destroy");
@@ -229,6 +396,27 @@ float interpolate_volume_db(float percent)
 	return -100.0f; // Fallback
 }
 
+// Inverse of interpolate_volume_db, maps a dB value back onto Wave Link's 0 - 100 volume
+float interpolate_volume_percent(float db)
+{
+	if (db <= volume_curve[0].db)
+		return volume_curve[0].percent;
+	if (db >= volume_curve[VOLUME_CURVE_SIZE - 1].db)
+		return volume_curve[VOLUME_CURVE_SIZE - 1].percent;
+
+	for (size_t i = 0; i < VOLUME_CURVE_SIZE - 1; ++i) {
+		const volume_map_t *a = &volume_curve[i];
+		const volume_map_t *b = &volume_curve[i + 1];
+
+		if (db >= a->db && db <= b->db) {
+			float t = (db - a->db) / (b->db - a->db);
+			return a->percent + t * (b->percent - a->percent); // Linear interpolation
+		}
+	}
+
+	return 0.0f; // Fallback
+}
+
 float getCombinedDb(filter_t *filter)
 {
 	float channel_volume = (float)WebSocketHandler::getChannelVolumeForFilter(filter);
@@ -240,6 +428,20 @@ float getCombinedDb(filter_t *filter)
 	return obs_db_to_mul(volume_db) * obs_db_to_mul(mixer_volume_db);
 }
 
+void publish_levels(filter_t *filter, uint32_t frames, const float *peak, const float *sum_squares)
+{
+	float rms[MAX_AUDIO_CHANNELS] = {};
+
+	for (size_t c = 0; c < filter->channels; c++) {
+		rms[c] = frames > 0 ? sqrtf(sum_squares[c] / (float)frames) : 0.0f;
+
+		filter->level_peak[c].store(peak[c], std::memory_order_relaxed);
+		filter->level_rms[c].store(rms[c], std::memory_order_relaxed);
+	}
+
+	SharedState::publishFilterLevels(filter->shared_state_slot, filter->channels, peak, rms);
+}
+
 obs_audio_data *filter_handle_audio(void *data, obs_audio_data *audio)
 {
 	auto filter = (filter_t *)data;
@@ -247,14 +449,77 @@ obs_audio_data *filter_handle_audio(void *data, obs_audio_data *audio)
 	float **adata = (float **)audio->data;
 	float gain = getCombinedDb(filter);
 
-	for (size_t c = 0; c < channels; c++) {
-		if (audio->data[c]) {
-			for (size_t i = 0; i < audio->frames; i++) {
-				adata[c][i] *= gain;
+	bool stale = WebSocketHandler::isStateStale();
+
+	if (stale && filter->stale_state_policy == StaleStatePolicy::MUTE) {
+		gain = 0.0f;
+	}
+
+	// Fade out while stale, fade back in once the state is fresh again (also covers switching policies)
+	float fade_target = stale && filter->stale_state_policy == StaleStatePolicy::FADE_OUT ? 0.0f : 1.0f;
+	float fade_start = filter->stale_fade;
+
+	float peak[MAX_AUDIO_CHANNELS] = {};
+	float sum_squares[MAX_AUDIO_CHANNELS] = {};
+
+	if (fade_start == fade_target) {
+		gain *= fade_target;
+
+		for (size_t c = 0; c < channels; c++) {
+			if (audio->data[c]) {
+				float *samples = adata[c];
+				float channel_peak = 0.0f;
+				float channel_sum = 0.0f;
+
+				// Levels are taken in the same pass that applies the gain. MSVC doesn't know the
+				// pragma without /openmp, there it's left to the auto-vectorizer.
+#ifndef _MSC_VER
+#pragma omp simd reduction(max : channel_peak) reduction(+ : channel_sum)
+#endif
+				for (size_t i = 0; i < audio->frames; i++) {
+					float sample = samples[i] * gain;
+					float magnitude = fabsf(sample);
+					samples[i] = sample;
+
+					// Not fmaxf, GCC won't vectorize that at -O2
+					channel_peak = magnitude > channel_peak ? magnitude : channel_peak;
+					channel_sum += sample * sample;
+				}
+
+				peak[c] = channel_peak;
+				sum_squares[c] = channel_sum;
+			}
+		}
+
+		publish_levels(filter, audio->frames, peak, sum_squares);
+
+		return audio;
+	}
+
+	float fade_step = 1000.0f / ((float)STALE_FADE_MS * (float)filter->sample_rate);
+	if (fade_target < fade_start)
+		fade_step = -fade_step;
+
+	float fade = fade_start;
+	for (size_t i = 0; i < audio->frames; i++) {
+		fade += fade_step;
+		if ((fade_step < 0.0f && fade < fade_target) || (fade_step > 0.0f && fade > fade_target))
+			fade = fade_target;
+
+		for (size_t c = 0; c < channels; c++) {
+			if (audio->data[c]) {
+				float sample = adata[c][i] * gain * fade;
+				adata[c][i] = sample;
+				peak[c] = fmaxf(peak[c], fabsf(sample));
+				sum_squares[c] += sample * sample;
 			}
 		}
 	}
 
+	filter->stale_fade = fade;
+
+	publish_levels(filter, audio->frames, peak, sum_squares);
+
 	return audio;
 }
 
@@ -273,6 +538,9 @@ obs_source_info create_audio_filter_info()
 	audio_filter_info.update = filter_update;
 	audio_filter_info.destroy = filter_destroy;
 
+	audio_filter_info.filter_add = filter_add;
+	audio_filter_info.filter_remove = filter_remove;
+
 	audio_filter_info.filter_audio = filter_handle_audio;
 
 	return audio_filter_info;
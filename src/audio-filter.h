@@ -1,14 +1,31 @@
 #pragma once
 
 #include <obs-module.h>
+#include <atomic>
 #include <string>
 
+// What a filter does while the connection is stalled. The cached volume is all a stalled filter has, so HOLD already
+// keeps applying it. FADE_OUT ramps from there to silence over STALE_FADE_MS and back once the state is fresh, as a
+// gentler MUTE.
+enum StaleStatePolicy { HOLD, FADE_OUT, MUTE };
+
 typedef struct {
 	obs_source_t *context;
+	// The source this filter is attached to, only set while its signals are connected
+	obs_source_t *parent;
 
 	size_t channels;
+	uint32_t sample_rate;
 
 	std::string channel;
+
+	// Mixers as saved in the settings, by ID since indices differ between sessions. Only written through
+	// WebSocketHandler::setFilterMixerIDs, which resolves them into the *_type indices the audio path uses.
+	std::string volume_mixer_id;
+	std::string channel_mixer_mute_id;
+	std::string apply_mixer_volume_id;
+	std::string follow_mixer_mute_id;
+
 	int volume_mixer_type;
 
 	bool follow_channel_mute;
@@ -19,4 +36,19 @@ typedef struct {
 
 	bool follow_mixer_mute;
 	int follow_mixer_mute_type;
+
+	int stale_state_policy;
+	// 1.0 while the state is fresh, ramps towards 0.0 while it's stale and the policy is FADE_OUT
+	float stale_fade;
+
+	bool push_obs_changes;
+
+	// Channel volume of the last audio tick, kept for ticks that can't look it up
+	int channel_volume;
+
+	// Post-gain levels of the last audio tick as linear amplitude, written by the audio thread only
+	std::atomic<float> level_peak[MAX_AUDIO_CHANNELS];
+	std::atomic<float> level_rms[MAX_AUDIO_CHANNELS];
+	// Slot in the shared-memory state, -1 if it isn't exported
+	int shared_state_slot;
 } filter_t;
\ No newline at end of file
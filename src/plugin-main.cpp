@@ -26,8 +26,29 @@ OBS_MODULE_USE_DEFAULT_LOCALE(PLUGIN_NAME, "en-US")
 extern struct obs_source_info create_audio_filter_info();
 struct obs_source_info audio_filter_info;
 
+// Settings that apply to the whole process rather than a single filter, from config.json in the module's
+// config directory
+static void load_module_config()
+{
+	char *path = obs_module_config_path("config.json");
+	if (!path)
+		return;
+
+	obs_data_t *config = obs_data_create_from_json_file_safe(path, "bak");
+	bfree(path);
+
+	if (!config)
+		return;
+
+	if (obs_data_has_user_value(config, "stall_budget_ms"))
+		WebSocketHandler::setStallBudgetMs((int)obs_data_get_int(config, "stall_budget_ms"));
+
+	obs_data_release(config);
+}
+
 bool obs_module_load(void)
 {
+	load_module_config();
 	WebSocketHandler::initialize();
 
 	audio_filter_info = create_audio_filter_info();
@@ -39,5 +60,7 @@ bool obs_module_load(void)
 
 void obs_module_unload(void)
 {
+	WebSocketHandler::shutdown();
+
 	obs_log(LOG_INFO, "plugin unloaded");
 }
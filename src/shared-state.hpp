@@ -0,0 +1,248 @@
+#pragma once
+
+#include <obs-module.h>
+#include <plugin-support.h>
+
+#include <wavelink-sync-state.h>
+
+#include <cstring>
+#include <mutex>
+#include <string>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Writer side of the shared-memory state export, see wavelink-sync-state.h for the reader side
+class SharedState {
+private:
+	static inline wavelink_sync_state *state = nullptr;
+	static inline std::string shm_name;
+	static inline std::mutex write_mutex;
+
+#ifndef _WIN32
+	static bool isProcessAlive(int32_t pid) { return kill(pid, 0) == 0 || errno == EPERM; }
+#endif
+
+public:
+	// Only takes the region if no other live process is exporting into it, a second OBS (or the stress tool
+	// pointed at the same name) would otherwise wipe its filters and break the seqlock with a second writer
+	static void open(const std::string &name = WAVELINK_SYNC_STATE_SHM_NAME)
+	{
+#ifndef _WIN32
+		bool created = true;
+		int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+		if (fd < 0 && errno == EEXIST) {
+			created = false;
+			fd = shm_open(name.c_str(), O_RDWR, 0);
+		}
+
+		if (fd < 0) {
+			obs_log(LOG_WARNING, "Failed to open shared memory %s, state won't be exported", name.c_str());
+			return;
+		}
+
+		// A region that's still smaller than ours is either being created right now or left over from a
+		// different layout. The latter can be removed by hand, it's gone after a reboot too.
+		struct stat stats;
+		if (!created && (fstat(fd, &stats) != 0 || stats.st_size < (off_t)sizeof(wavelink_sync_state))) {
+			obs_log(LOG_WARNING,
+				"Shared memory %s is in use or from another version, state won't be exported",
+				name.c_str());
+			::close(fd);
+			return;
+		}
+
+		if (created && ftruncate(fd, sizeof(wavelink_sync_state)) != 0) {
+			obs_log(LOG_WARNING, "Failed to size shared memory %s, state won't be exported", name.c_str());
+			::close(fd);
+			shm_unlink(name.c_str());
+			return;
+		}
+
+		void *memory = mmap(nullptr, sizeof(wavelink_sync_state), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		::close(fd);
+
+		if (memory == MAP_FAILED) {
+			obs_log(LOG_WARNING, "Failed to map shared memory %s, state won't be exported", name.c_str());
+			if (created)
+				shm_unlink(name.c_str());
+			return;
+		}
+
+		wavelink_sync_state *region = (wavelink_sync_state *)memory;
+
+		// Take over from an owner that is gone. The exchange makes sure only one of several processes starting
+		// at the same time does, the others see it owned by the winner.
+		int32_t owner = __atomic_load_n(&region->owner_pid, __ATOMIC_ACQUIRE);
+		if ((owner != 0 && isProcessAlive(owner)) ||
+		    !__atomic_compare_exchange_n(&region->owner_pid, &owner, (int32_t)getpid(), false, __ATOMIC_ACQ_REL,
+						 __ATOMIC_ACQUIRE)) {
+			obs_log(LOG_WARNING, "Shared memory %s is exported by process %d, state won't be exported",
+				name.c_str(), owner);
+			munmap(memory, sizeof(wavelink_sync_state));
+			return;
+		}
+
+		state = region;
+		shm_name = name;
+
+		// Readers of a previous session might still be mapped, so the sequences keep counting up. An odd one
+		// was left behind by a session that died in the middle of a write and would keep readers spinning.
+		uint32_t sequence = __atomic_load_n(&state->sequence, __ATOMIC_RELAXED);
+		if (sequence & 1)
+			__atomic_store_n(&state->sequence, sequence + 1, __ATOMIC_RELEASE);
+
+		wavelink_sync_state *shared = beginWrite();
+
+		shared->magic = WAVELINK_SYNC_STATE_MAGIC;
+		shared->version = WAVELINK_SYNC_STATE_VERSION;
+		shared->size = sizeof(wavelink_sync_state);
+
+		// Filters of a previous session that didn't shut down cleanly
+		for (auto &filter : shared->filters) {
+			filter.active = 0;
+
+			uint32_t levels_sequence = __atomic_load_n(&filter.levels_sequence, __ATOMIC_RELAXED);
+			if (levels_sequence & 1)
+				__atomic_store_n(&filter.levels_sequence, levels_sequence + 1, __ATOMIC_RELEASE);
+		}
+
+		endWrite();
+
+		obs_log(LOG_INFO, "Exporting state to shared memory %s", name.c_str());
+#endif
+	}
+
+	static void close()
+	{
+#ifndef _WIN32
+		if (!state)
+			return;
+
+		// Unlinked first so nobody else can open it and take over before it's gone
+		shm_unlink(shm_name.c_str());
+		__atomic_store_n(&state->owner_pid, 0, __ATOMIC_RELEASE);
+
+		munmap(state, sizeof(wavelink_sync_state));
+		state = nullptr;
+#endif
+	}
+
+	// Returns the region to write into (with write_mutex held), or nullptr if nothing is exported.
+	// Every non-null result has to be followed by endWrite().
+	static wavelink_sync_state *beginWrite()
+	{
+#ifdef _WIN32
+		return nullptr;
+#else
+		if (!state)
+			return nullptr;
+
+		write_mutex.lock();
+
+		uint32_t sequence = __atomic_load_n(&state->sequence, __ATOMIC_RELAXED);
+		__atomic_store_n(&state->sequence, sequence + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+
+		return state;
+#endif
+	}
+
+	static void endWrite()
+	{
+#ifndef _WIN32
+		uint32_t sequence = __atomic_load_n(&state->sequence, __ATOMIC_RELAXED);
+		__atomic_store_n(&state->sequence, sequence + 1, __ATOMIC_RELEASE);
+
+		write_mutex.unlock();
+#endif
+	}
+
+	static void copyString(char *destination, size_t size, const std::string &source)
+	{
+		size_t length = std::min(size - 1, source.size());
+		memcpy(destination, source.data(), length);
+		destination[length] = '\0';
+	}
+
+	// Returns the filter slot to publish levels into, or -1 if there is none
+	static int acquireFilterSlot()
+	{
+		wavelink_sync_state *shared = beginWrite();
+		if (!shared)
+			return -1;
+
+		int slot = -1;
+		for (int i = 0; i < WAVELINK_SYNC_STATE_MAX_FILTERS; i++) {
+			if (!shared->filters[i].active) {
+				shared->filters[i].active = 1;
+				shared->filters[i].source_name[0] = '\0';
+				shared->filters[i].channel[0] = '\0';
+				slot = i;
+				break;
+			}
+		}
+
+		endWrite();
+
+		return slot;
+	}
+
+	static void releaseFilterSlot(int slot)
+	{
+		if (slot < 0)
+			return;
+
+		wavelink_sync_state *shared = beginWrite();
+		if (!shared)
+			return;
+
+		shared->filters[slot].active = 0;
+
+		endWrite();
+	}
+
+	static void setFilterInfo(int slot, const std::string &source_name, const std::string &channel)
+	{
+		if (slot < 0)
+			return;
+
+		wavelink_sync_state *shared = beginWrite();
+		if (!shared)
+			return;
+
+		copyString(shared->filters[slot].source_name, sizeof(shared->filters[slot].source_name), source_name);
+		copyString(shared->filters[slot].channel, sizeof(shared->filters[slot].channel), channel);
+
+		endWrite();
+	}
+
+	// Only ever called from the audio thread of the filter owning the slot, so it doesn't need write_mutex
+	static void publishFilterLevels(int slot, size_t channels, const float *peak, const float *rms)
+	{
+#ifndef _WIN32
+		if (slot < 0 || !state)
+			return;
+
+		wavelink_sync_state_filter &filter = state->filters[slot];
+
+		uint32_t sequence = __atomic_load_n(&filter.levels_sequence, __ATOMIC_RELAXED);
+		__atomic_store_n(&filter.levels_sequence, sequence + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+
+		filter.audio_channels = (uint32_t)channels;
+		for (size_t c = 0; c < channels; c++) {
+			filter.peak[c] = peak[c];
+			filter.rms[c] = rms[c];
+		}
+
+		__atomic_store_n(&filter.levels_sequence, sequence + 2, __ATOMIC_RELEASE);
+#endif
+	}
+};
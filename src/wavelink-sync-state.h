@@ -0,0 +1,177 @@
+/*
+Shared-memory state published by the Wave Link Sync plugin.
+
+Other plugins and tools can map this instead of opening their own connection to Wave Link:
+
+	int fd = shm_open(WAVELINK_SYNC_STATE_SHM_NAME, O_RDONLY, 0);
+	const struct wavelink_sync_state *state =
+		mmap(NULL, sizeof(struct wavelink_sync_state), PROT_READ, MAP_SHARED, fd, 0);
+
+	if (state->magic != WAVELINK_SYNC_STATE_MAGIC || state->version != WAVELINK_SYNC_STATE_VERSION)
+		// Not a layout this header knows about
+
+	uint32_t sequence;
+	do {
+		sequence = wavelink_sync_state_read_begin(state);
+		// Read whatever is needed straight from *state
+	} while (wavelink_sync_state_read_retry(state, sequence));
+
+The region is protected by a seqlock, readers never block the plugin and the plugin never waits for readers.
+Anything read between begin and retry has to be thrown away if retry returns true.
+
+read_begin spins for as long as a write is in progress. Writes only take microseconds, but if the plugin dies
+in the middle of one the sequence stays odd until OBS starts again. Readers that can't afford to hang use the
+try_ variants instead, which give up after WAVELINK_SYNC_STATE_READ_SPINS attempts:
+
+	if (!wavelink_sync_state_try_read_begin(state, &sequence))
+		// Still being written, try again later
+
+The post-gain levels of every filter are updated on each audio tick, so they have a seqlock of their own:
+
+	const struct wavelink_sync_state_filter *filter = &state->filters[i];
+
+	do {
+		sequence = wavelink_sync_state_filter_read_begin(filter);
+		// Read audio_channels, peak and rms
+	} while (wavelink_sync_state_filter_read_retry(filter, sequence));
+
+Only available on Linux and macOS.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WAVELINK_SYNC_STATE_SHM_NAME "/wavelink-sync-state"
+#define WAVELINK_SYNC_STATE_MAGIC 0x4B4C5657 // "WVLK"
+#define WAVELINK_SYNC_STATE_VERSION 3
+
+#define WAVELINK_SYNC_STATE_MAX_MIXERS 32
+#define WAVELINK_SYNC_STATE_MAX_CHANNELS 64
+#define WAVELINK_SYNC_STATE_ID_LENGTH 128
+#define WAVELINK_SYNC_STATE_NAME_LENGTH 64
+#define WAVELINK_SYNC_STATE_MAX_FILTERS 256
+#define WAVELINK_SYNC_STATE_MAX_AUDIO_CHANNELS 8
+
+#define WAVELINK_SYNC_STATE_READ_SPINS 100000
+
+struct wavelink_sync_state_mixer {
+	char id[WAVELINK_SYNC_STATE_ID_LENGTH];
+	char name[WAVELINK_SYNC_STATE_NAME_LENGTH];
+	uint8_t muted;
+	int32_t volume;
+};
+
+struct wavelink_sync_state_channel {
+	char identifier[WAVELINK_SYNC_STATE_ID_LENGTH];
+	char name[WAVELINK_SYNC_STATE_NAME_LENGTH];
+
+	// Indexed the same way as wavelink_sync_state.mixers
+	uint8_t muted[WAVELINK_SYNC_STATE_MAX_MIXERS];
+	int32_t volume[WAVELINK_SYNC_STATE_MAX_MIXERS];
+};
+
+struct wavelink_sync_state_filter {
+	// Guarded by wavelink_sync_state.sequence
+	uint8_t active;
+	char source_name[WAVELINK_SYNC_STATE_NAME_LENGTH];
+	char channel[WAVELINK_SYNC_STATE_ID_LENGTH]; // Identifier of the Wave Link channel it follows
+
+	// Guarded by levels_sequence. Linear amplitude after the filter's gain, peak and RMS of the last audio tick.
+	uint32_t levels_sequence;
+	uint32_t audio_channels;
+	float peak[WAVELINK_SYNC_STATE_MAX_AUDIO_CHANNELS];
+	float rms[WAVELINK_SYNC_STATE_MAX_AUDIO_CHANNELS];
+};
+
+struct wavelink_sync_state {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size; // sizeof(struct wavelink_sync_state) of the writer
+	int32_t owner_pid; // Process exporting the state, 0 once it has stopped. Only one process writes at a time.
+
+	// Odd while the plugin is writing, use the functions below instead of reading it directly
+	uint32_t sequence;
+
+	uint8_t connected;
+	int64_t rtt_us; // -1 if not measured yet
+	uint64_t updated_ns;
+
+	// Entry 0 is unused, valid mixers are 1 to mixer_count - 1
+	uint32_t mixer_count;
+	uint32_t channel_count;
+
+	struct wavelink_sync_state_mixer mixers[WAVELINK_SYNC_STATE_MAX_MIXERS];
+	struct wavelink_sync_state_channel channels[WAVELINK_SYNC_STATE_MAX_CHANNELS];
+
+	// Slots of removed filters are kept around with active set to 0
+	struct wavelink_sync_state_filter filters[WAVELINK_SYNC_STATE_MAX_FILTERS];
+};
+
+#ifndef _MSC_VER
+// Returns 0 if a write is still in progress after WAVELINK_SYNC_STATE_READ_SPINS attempts
+static inline int wavelink_sync_state_try_read_begin(const struct wavelink_sync_state *state, uint32_t *sequence)
+{
+	for (uint32_t i = 0; i < WAVELINK_SYNC_STATE_READ_SPINS; i++) {
+		*sequence = __atomic_load_n(&state->sequence, __ATOMIC_ACQUIRE);
+		if (!(*sequence & 1))
+			return 1;
+	}
+
+	return 0;
+}
+
+// Spins until no write is in progress, which is forever if the plugin died in the middle of one
+static inline uint32_t wavelink_sync_state_read_begin(const struct wavelink_sync_state *state)
+{
+	uint32_t sequence;
+
+	while (!wavelink_sync_state_try_read_begin(state, &sequence))
+		;
+
+	return sequence;
+}
+
+static inline int wavelink_sync_state_read_retry(const struct wavelink_sync_state *state, uint32_t sequence)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&state->sequence, __ATOMIC_RELAXED) != sequence;
+}
+
+static inline int wavelink_sync_state_filter_try_read_begin(const struct wavelink_sync_state_filter *filter,
+							     uint32_t *sequence)
+{
+	for (uint32_t i = 0; i < WAVELINK_SYNC_STATE_READ_SPINS; i++) {
+		*sequence = __atomic_load_n(&filter->levels_sequence, __ATOMIC_ACQUIRE);
+		if (!(*sequence & 1))
+			return 1;
+	}
+
+	return 0;
+}
+
+static inline uint32_t wavelink_sync_state_filter_read_begin(const struct wavelink_sync_state_filter *filter)
+{
+	uint32_t sequence;
+
+	while (!wavelink_sync_state_filter_try_read_begin(filter, &sequence))
+		;
+
+	return sequence;
+}
+
+static inline int wavelink_sync_state_filter_read_retry(const struct wavelink_sync_state_filter *filter,
+							 uint32_t sequence)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&filter->levels_sequence, __ATOMIC_RELAXED) != sequence;
+}
+#endif
+
+#ifdef __cplusplus
+}
+#endif
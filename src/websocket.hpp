@@ -8,54 +8,235 @@
 #include <ixwebsocket/IXWebSocket.h>
 #include <ixwebsocket/IXUserAgent.h>
 #include <iostream>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <string_view>
+#include <thread>
 
 #include <audio-filter.h>
+#include <shared-state.hpp>
 
+// Mixers are densely indexed. LOCAL and STREAM always exist, any other mix the server reports
+// gets the next free index when it's first seen. EITHER stands for all of them at once.
 enum MixerType { INVALID, LOCAL, STREAM, EITHER = 100 };
 
+#define MAX_MIXERS 32
+static_assert(MAX_MIXERS == WAVELINK_SYNC_STATE_MAX_MIXERS, "Shared state has to fit every mixer");
+
+// Saved in filter settings instead of a mixer ID when either mixer counts
+#define MIXER_ID_EITHER "either"
+
 struct Mixer {
+	std::string id;         // e.g. "com.elgato.mix.local"
+	std::string config_key; // e.g. "localMixer", as used in the input and output configs
+	std::string name;
+
 	bool muted;
 	int volume;
 };
 
+enum BatchSupport { UNKNOWN, SUPPORTED, UNSUPPORTED };
+
+// Negotiated through the WebSocket subprotocol, servers that don't pick one (like Wave Link itself) get JSON text
+enum MessageCodec { JSON_TEXT, CBOR, MSGPACK };
+
+#define CBOR_SUBPROTOCOL "wavelink-sync.cbor"
+#define MSGPACK_SUBPROTOCOL "wavelink-sync.msgpack"
+
+// Precomputed request bodies per codec, only the ID gets serialized on send.
+// The JSON prefix is everything up to the ID value. The binary bodies are the map entries after the ID,
+// which always comes first since it's the only key and nlohmann::json sorts the remaining ones.
+struct RequestTemplate {
+	std::string json_prefix;
+	std::string cbor_body;
+	std::string msgpack_body;
+};
+
+static RequestTemplate makeRequestTemplate(const std::string &method)
+{
+	RequestTemplate request_template;
+	request_template.json_prefix = R"({"jsonrpc":"2.0","method":")" + method + R"(","id":)";
+
+	// Drop the map header of the two remaining entries, it's written together with the ID
+	nlohmann::json body = {{"jsonrpc", "2.0"}, {"method", method}};
+	nlohmann::json::to_cbor(body, request_template.cbor_body);
+	nlohmann::json::to_msgpack(body, request_template.msgpack_body);
+	request_template.cbor_body.erase(0, 1);
+	request_template.msgpack_body.erase(0, 1);
+
+	return request_template;
+}
+
+static inline const RequestTemplate input_configs_request = makeRequestTemplate("getInputConfigs");
+static inline const RequestTemplate output_config_request = makeRequestTemplate("getOutputConfig");
+static inline const RequestTemplate set_input_config_request = makeRequestTemplate("setInputConfig");
+
+// Upper bounds of the RTT histogram buckets in microseconds, the last bucket catches everything above
+static constexpr int64_t rtt_bucket_bounds_us[] = {500, 1000, 2000, 5000, 10000, 20000, 50000, 100000, 250000, 500000};
+#define RTT_BUCKET_COUNT (sizeof(rtt_bucket_bounds_us) / sizeof(int64_t) + 1)
+
+#define HEARTBEAT_TICK_MS 250
+#define HEARTBEAT_PING_INTERVAL_MS 1000
+
+// Nothing received from the server for this long means the connection has stalled. Process-wide, can be set
+// through stall_budget_ms in the module's config.json.
+#define DEFAULT_STALL_BUDGET_MS 3000
+// Anything below two ping intervals would keep reconnecting a healthy connection
+#define MIN_STALL_BUDGET_MS (2 * HEARTBEAT_PING_INTERVAL_MS)
+#define MAX_STALL_BUDGET_MS 60000
+
+// Outbound volume/mute updates are sent at most this often per channel and mixer, anything in between is coalesced
+#define OUTBOUND_MIN_INTERVAL_MS 50
+// How long a sent value is expected to come back as a *Changed notification
+#define OUTBOUND_ECHO_WINDOW_MS 1000
+// Sent values that are remembered per channel and mixer, in case the server doesn't echo them at all
+#define OUTBOUND_MAX_IN_FLIGHT 32
+
+struct OutboundUpdate {
+	std::string identifier;
+	MixerType mixer_type;
+	bool is_mute;
+
+	int value;
+	bool pending;
+	int64_t last_sent_ns;
+
+	// Values that were sent, but haven't come back as a notification yet, with the time they were sent
+	std::vector<std::pair<int, int64_t>> in_flight;
+};
+
+float interpolate_volume_db(float percent);
+
 struct Channel {
 	std::string identifier;
 	std::string name;
 
-	std::unordered_map<MixerType, bool> muted;
-	std::unordered_map<MixerType, int> volume;
+	bool muted[MAX_MIXERS];
+	int volume[MAX_MIXERS];
+
+	// Kept up to date on every change so EITHER doesn't have to look at every mixer on the audio thread
+	bool any_muted;
 };
 
 class WebSocketHandler {
 private:
 	static inline ix::WebSocket webSocket;
-	static inline std::unordered_map<MixerType, Mixer *> mixers;
+	static inline Mixer mixers[MAX_MIXERS] = {
+		{},
+		{"com.elgato.mix.local", "localMixer", "Monitor Mix"},
+		{"com.elgato.mix.stream", "streamMixer", "Stream Mix"},
+	};
+	// Mixers are only ever appended, so everything below this is safe to read from any thread
+	static inline std::atomic<int> mixer_count = MixerType::STREAM + 1;
+	static inline std::unordered_map<std::string, int> mixer_indices = {
+		{"com.elgato.mix.local", MixerType::LOCAL},
+		{"com.elgato.mix.stream", MixerType::STREAM},
+	};
+	static inline bool any_mixer_muted = false;
+
+	// Their mixer IDs are resolved to indices again whenever a mixer is discovered
+	static inline std::set<filter_t *> filters;
+	static inline std::mutex filters_mutex;
+
+	// Set on the UI thread while a Wave Link value is put on a source's fader or mute, so the signal that fires
+	// doesn't get pushed right back
+	static inline thread_local bool applying_to_parent = false;
+
+	// Exclusive for anything that writes to the channels, shared for reading them.
+	// Audio threads only ever try to take it, see getChannelVolumeForFilter.
 	static inline std::unordered_map<std::string, Channel *> channels;
+	static inline std::shared_mutex channels_mutex;
+
+	// Every request takes the next ID, so a response can never be taken for a different request
+	static inline std::atomic<int> next_request_id = 1;
+
+	static inline std::atomic<int> input_configs_id = 0;
+	static inline std::atomic<int> output_config_id = 0;
+	static inline std::atomic<int> batch_probe_id = 0;
+
+	// Stays around for the whole session so that serializing a request never has to allocate
+	static inline std::string request_buffer;
+	static inline std::mutex request_mutex;
+
+	static inline std::atomic<MessageCodec> codec = MessageCodec::JSON_TEXT;
+
+	// Whether the server understands JSON-RPC 2.0 batches. Learned again on every connection, since the server
+	// on the other end may not be the same one.
+	static inline BatchSupport batch_support = BatchSupport::UNKNOWN;
+
+	static inline std::thread worker_thread;
+	static inline std::mutex worker_mutex;
+	static inline std::condition_variable worker_cv;
+	static inline std::atomic<bool> worker_running = false;
+
+	// Steady clock timestamps in nanoseconds
+	static inline std::atomic<int64_t> last_contact_ns = 0;
+	static inline std::atomic<int64_t> ping_sent_ns = 0;
+	static inline std::atomic<uint32_t> ping_sequence = 0;
+
+	static inline std::atomic<int> stall_budget_ms = DEFAULT_STALL_BUDGET_MS;
+
+	static inline std::atomic<bool> has_state = false;
+
+	static inline std::atomic<int64_t> last_rtt_us = -1;
+	static inline std::atomic<uint32_t> rtt_histogram[RTT_BUCKET_COUNT] = {};
 
-	static inline int input_configs_id = 469;
-	static inline int output_config_id = 470;
+	// Keyed by identifier, mixer and property. Guarded by worker_mutex.
+	static inline std::map<std::string, OutboundUpdate> outbound_updates;
 
 public:
-	static void initialize()
+	static void initialize(const std::string &url = "ws://localhost:1824",
+			       const std::string &shared_state_name = WAVELINK_SYNC_STATE_SHM_NAME)
 	{
-		srand((unsigned int)time(NULL));
+		request_buffer.reserve(256);
 
 		ix::initNetSystem();
 
-		std::string url("ws://localhost:1824");
 		webSocket.setUrl(url);
 		webSocket.setMaxWaitBetweenReconnectionRetries(3);
 
+		// Listed in order of preference, Wave Link picks neither and stays on JSON text
+		webSocket.addSubProtocol(MSGPACK_SUBPROTOCOL);
+		webSocket.addSubProtocol(CBOR_SUBPROTOCOL);
+
 		obs_log(LOG_INFO, "Attempting to connect to WebSocket...");
 
 		webSocket.setOnMessageCallback([](const ix::WebSocketMessagePtr &msg) {
 			if (msg->type == ix::WebSocketMessageType::Message) {
-				handleWebsocketMessage(msg->str);
+				last_contact_ns = getTimeNs();
+
+				if (msg->binary) {
+					handleBinaryWebsocketMessage(msg->str);
+				} else {
+					handleWebsocketMessage(msg->str);
+				}
+
+				publishSharedState();
+			} else if (msg->type == ix::WebSocketMessageType::Pong) {
+				last_contact_ns = getTimeNs();
+				handlePong(msg->str);
+				publishSharedState();
 			} else if (msg->type == ix::WebSocketMessageType::Open) {
 				obs_log(LOG_INFO, "WebSocket connection established.");
 
-				sendGetInputConfigsMessage();
-				sendGetOutputConfigMessage();
+				setCodecFromSubprotocol(msg->openInfo.protocol);
+				batch_support = BatchSupport::UNKNOWN;
+
+				last_contact_ns = getTimeNs();
+				sendFullStateRequest();
+				publishSharedState();
+			} else if (msg->type == ix::WebSocketMessageType::Close) {
+				publishSharedState();
 			} else if (msg->type == ix::WebSocketMessageType::Error) {
 				// Server probably isn't up, fail silently
 				if (msg->errorInfo.http_status == 0)
@@ -66,7 +247,386 @@ public:
 			}
 		});
 
+		SharedState::open(shared_state_name);
+		publishSharedState();
+
 		webSocket.start();
+
+		worker_running = true;
+		worker_thread = std::thread(workerLoop);
+	}
+
+	// Meant to be called before initialize, the budget applies to the whole process
+	static void setStallBudgetMs(int budget_ms)
+	{
+		int clamped = std::clamp(budget_ms, MIN_STALL_BUDGET_MS, MAX_STALL_BUDGET_MS);
+		if (clamped != budget_ms)
+			obs_log(LOG_WARNING, "Stall budget of %d ms is out of range, using %d ms", budget_ms, clamped);
+
+		stall_budget_ms = clamped;
+	}
+
+	static void shutdown()
+	{
+		{
+			std::lock_guard<std::mutex> lock(worker_mutex);
+			worker_running = false;
+		}
+		worker_cv.notify_all();
+
+		if (worker_thread.joinable())
+			worker_thread.join();
+
+		webSocket.stop();
+		ix::uninitNetSystem();
+
+		SharedState::close();
+	}
+
+	static void setCodecFromSubprotocol(const std::string &protocol)
+	{
+		if (protocol == MSGPACK_SUBPROTOCOL) {
+			codec = MessageCodec::MSGPACK;
+		} else if (protocol == CBOR_SUBPROTOCOL) {
+			codec = MessageCodec::CBOR;
+		} else {
+			codec = MessageCodec::JSON_TEXT;
+		}
+
+		if (codec != MessageCodec::JSON_TEXT)
+			obs_log(LOG_INFO, "Using binary %s messages", protocol.c_str());
+	}
+
+	static void publishSharedState()
+	{
+		wavelink_sync_state *state = SharedState::beginWrite();
+		if (!state)
+			return;
+
+		state->connected = webSocket.getReadyState() == ix::ReadyState::Open;
+		state->rtt_us = last_rtt_us;
+		state->updated_ns = (uint64_t)getTimeNs();
+
+		int count = mixer_count;
+		state->mixer_count = (uint32_t)count;
+
+		for (int i = MixerType::LOCAL; i < count; i++) {
+			auto &shared_mixer = state->mixers[i];
+			SharedState::copyString(shared_mixer.id, sizeof(shared_mixer.id), mixers[i].id);
+			SharedState::copyString(shared_mixer.name, sizeof(shared_mixer.name), mixers[i].name);
+			shared_mixer.muted = mixers[i].muted;
+			shared_mixer.volume = mixers[i].volume;
+		}
+
+		// Also called from the OBS signal thread when a pushed value is applied locally
+		std::shared_lock<std::shared_mutex> channels_lock(channels_mutex);
+
+		uint32_t channel_count = 0;
+		for (auto &[identifier, channel] : channels) {
+			if (channel_count == WAVELINK_SYNC_STATE_MAX_CHANNELS)
+				break;
+
+			auto &shared_channel = state->channels[channel_count++];
+			SharedState::copyString(shared_channel.identifier, sizeof(shared_channel.identifier),
+						channel->identifier);
+			SharedState::copyString(shared_channel.name, sizeof(shared_channel.name), channel->name);
+
+			for (int i = MixerType::LOCAL; i < count; i++) {
+				shared_channel.muted[i] = channel->muted[i];
+				shared_channel.volume[i] = channel->volume[i];
+			}
+		}
+
+		state->channel_count = channel_count;
+
+		SharedState::endWrite();
+	}
+
+	static int64_t getTimeNs()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			       std::chrono::steady_clock::now().time_since_epoch())
+			.count();
+	}
+
+	static void workerLoop()
+	{
+		int64_t next_ping_ns = 0;
+
+		std::unique_lock<std::mutex> lock(worker_mutex);
+		while (worker_running) {
+			worker_cv.wait_for(lock, std::chrono::nanoseconds(getNextWakeNs() - getTimeNs()));
+			if (!worker_running)
+				break;
+
+			if (webSocket.getReadyState() != ix::ReadyState::Open)
+				continue;
+
+			int64_t now = getTimeNs();
+
+			int budget_ms = stall_budget_ms;
+			if (now - last_contact_ns > (int64_t)budget_ms * 1000000) {
+				obs_log(LOG_WARNING, "No response from WebSocket for over %d ms, reconnecting...",
+					budget_ms);
+
+				// Automatic reconnection takes over from here, the full resync happens once it's open
+				// again
+				last_contact_ns = now;
+				webSocket.close();
+				continue;
+			}
+
+			flushOutboundUpdates(now);
+
+			if (now >= next_ping_ns) {
+				next_ping_ns = now + (int64_t)HEARTBEAT_PING_INTERVAL_MS * 1000000;
+				sendPing();
+			}
+		}
+	}
+
+	// Called with worker_mutex held
+	static int64_t getNextWakeNs()
+	{
+		int64_t now = getTimeNs();
+		int64_t wake_ns = now + (int64_t)HEARTBEAT_TICK_MS * 1000000;
+
+		if (webSocket.getReadyState() != ix::ReadyState::Open)
+			return wake_ns;
+
+		for (auto &[key, update] : outbound_updates) {
+			if (update.pending)
+				wake_ns = std::min(wake_ns,
+						   update.last_sent_ns + (int64_t)OUTBOUND_MIN_INTERVAL_MS * 1000000);
+		}
+
+		return wake_ns;
+	}
+
+	static std::string getOutboundKey(const std::string &identifier, MixerType mixer_type, bool is_mute)
+	{
+		return identifier + "|" + std::to_string(mixer_type) + (is_mute ? "|mute" : "|volume");
+	}
+
+	static void queueInputUpdate(const std::string &identifier, MixerType mixer_type, bool is_mute, int value)
+	{
+		if (mixer_type == MixerType::EITHER) {
+			for (int i = MixerType::LOCAL; i < mixer_count; i++)
+				queueInputUpdate(identifier, static_cast<MixerType>(i), is_mute, value);
+			return;
+		}
+
+		if (!isValidMixer(mixer_type))
+			return;
+
+		// Apply it locally right away, the echo from the server gets dropped later on
+		if (is_mute) {
+			updateFilterMuted(identifier, mixer_type, value != 0);
+		} else {
+			updateFilterVolume(identifier, mixer_type, value);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(worker_mutex);
+
+			auto &update = outbound_updates[getOutboundKey(identifier, mixer_type, is_mute)];
+			update.identifier = identifier;
+			update.mixer_type = mixer_type;
+			update.is_mute = is_mute;
+			update.value = value;
+			update.pending = true;
+		}
+
+		worker_cv.notify_all();
+
+		publishSharedState();
+	}
+
+	static void queueInputVolume(const std::string &identifier, MixerType mixer_type, int volume)
+	{
+		queueInputUpdate(identifier, mixer_type, false, volume);
+	}
+
+	static void queueInputMute(const std::string &identifier, MixerType mixer_type, bool muted)
+	{
+		queueInputUpdate(identifier, mixer_type, true, muted);
+	}
+
+	// Called with worker_mutex held
+	static void flushOutboundUpdates(int64_t now)
+	{
+		int64_t expired_ns = now - (int64_t)OUTBOUND_ECHO_WINDOW_MS * 1000000;
+
+		for (auto &[key, update] : outbound_updates) {
+			// Oldest first, anything past the window isn't going to be matched by isOwnEcho anymore
+			auto &in_flight = update.in_flight;
+			size_t expired = 0;
+			while (expired < in_flight.size() && in_flight[expired].second < expired_ns)
+				expired++;
+			in_flight.erase(in_flight.begin(), in_flight.begin() + expired);
+
+			if (!update.pending || now - update.last_sent_ns < (int64_t)OUTBOUND_MIN_INTERVAL_MS * 1000000)
+				continue;
+
+			sendSetInputConfigMessage(update);
+
+			if (in_flight.size() >= OUTBOUND_MAX_IN_FLIGHT)
+				in_flight.erase(in_flight.begin());
+
+			update.pending = false;
+			update.last_sent_ns = now;
+			in_flight.push_back({update.value, now});
+		}
+	}
+
+	// Sent up to every OUTBOUND_MIN_INTERVAL_MS while a fader is dragged, so it's serialized straight into
+	// request_buffer instead of going through nlohmann::json
+	static void sendSetInputConfigMessage(const OutboundUpdate &update)
+	{
+		std::lock_guard<std::mutex> lock(request_mutex);
+		MessageCodec message_codec = codec;
+
+		request_buffer.clear();
+		appendRequest(request_buffer, message_codec, set_input_config_request, getNextRequestID(), true);
+
+		const std::string &mixer_id = getMixerID(update.mixer_type);
+		std::string_view property = update.is_mute ? "Mute" : "Volume";
+
+		if (message_codec == MessageCodec::JSON_TEXT) {
+			request_buffer.append(R"({"identifier":)");
+			appendJsonString(request_buffer, update.identifier);
+			request_buffer.append(R"(,"mixerID":)");
+			appendJsonString(request_buffer, mixer_id);
+			request_buffer.append(R"(,"property":)");
+			appendJsonString(request_buffer, property);
+			request_buffer.append(R"(,"value":)");
+
+			if (update.is_mute) {
+				request_buffer.append(update.value != 0 ? "true" : "false");
+			} else {
+				char value_chars[16];
+				char *end = std::to_chars(value_chars, std::end(value_chars), update.value).ptr;
+				request_buffer.append(value_chars, end);
+			}
+
+			request_buffer.append(R"(,"forceLink":false}})");
+		} else {
+			bool is_cbor = message_codec == MessageCodec::CBOR;
+
+			// Map with 5 entries
+			request_buffer.push_back(is_cbor ? (char)0xA5 : (char)0x85);
+
+			appendBinaryString(request_buffer, message_codec, "identifier");
+			appendBinaryString(request_buffer, message_codec, update.identifier);
+			appendBinaryString(request_buffer, message_codec, "mixerID");
+			appendBinaryString(request_buffer, message_codec, mixer_id);
+			appendBinaryString(request_buffer, message_codec, "property");
+			appendBinaryString(request_buffer, message_codec, property);
+			appendBinaryString(request_buffer, message_codec, "value");
+
+			if (update.is_mute) {
+				appendBinaryBool(request_buffer, message_codec, update.value != 0);
+			} else {
+				appendBinaryUint(request_buffer, message_codec, (uint32_t)std::max(update.value, 0));
+			}
+
+			appendBinaryString(request_buffer, message_codec, "forceLink");
+			appendBinaryBool(request_buffer, message_codec, false);
+		}
+
+		webSocket.send(request_buffer, message_codec != MessageCodec::JSON_TEXT);
+	}
+
+	// Whether an input notification is just the server confirming a value we sent ourselves.
+	// Those are dropped so an older confirmation can't undo a newer local change while a fader is dragged.
+	static bool isOwnEcho(const std::string &identifier, MixerType mixer_type, bool is_mute, int value)
+	{
+		std::lock_guard<std::mutex> lock(worker_mutex);
+
+		auto it = outbound_updates.find(getOutboundKey(identifier, mixer_type, is_mute));
+		if (it == outbound_updates.end())
+			return false;
+
+		auto &in_flight = it->second.in_flight;
+		int64_t expired_ns = getTimeNs() - (int64_t)OUTBOUND_ECHO_WINDOW_MS * 1000000;
+
+		for (size_t i = 0; i < in_flight.size(); i++) {
+			if (in_flight[i].first == value && in_flight[i].second >= expired_ns) {
+				in_flight.erase(in_flight.begin(), in_flight.begin() + i + 1);
+				return true;
+			}
+		}
+
+		// Someone else changed it, nothing we sent is going to come back anymore
+		in_flight.clear();
+		return false;
+	}
+
+	static void sendPing()
+	{
+		uint32_t sequence = ++ping_sequence;
+
+		char payload[16];
+		char *end = std::to_chars(payload, payload + sizeof(payload), sequence).ptr;
+
+		ping_sent_ns = getTimeNs();
+		webSocket.ping(std::string(payload, end));
+	}
+
+	static void handlePong(const std::string &payload)
+	{
+		uint32_t sequence = 0;
+		std::from_chars(payload.data(), payload.data() + payload.size(), sequence);
+
+		// Only the latest ping is timed, late pongs for older ones are just counted as contact
+		if (sequence != ping_sequence)
+			return;
+
+		int64_t rtt_us = (getTimeNs() - ping_sent_ns) / 1000;
+		last_rtt_us = rtt_us;
+
+		size_t bucket = 0;
+		while (bucket < RTT_BUCKET_COUNT - 1 && rtt_us > rtt_bucket_bounds_us[bucket])
+			bucket++;
+
+		rtt_histogram[bucket]++;
+	}
+
+	// Returns the upper bound in microseconds of the bucket the given percentile falls into.
+	// -1 if nothing was measured yet, INT64_MAX if it lands in the last, unbounded bucket.
+	static int64_t getRttPercentileUs(double percentile)
+	{
+		uint64_t total = 0;
+		for (auto &count : rtt_histogram)
+			total += count;
+
+		if (total == 0)
+			return -1;
+
+		uint64_t threshold = (uint64_t)(total * percentile);
+		uint64_t seen = 0;
+
+		for (size_t i = 0; i < RTT_BUCKET_COUNT - 1; i++) {
+			seen += rtt_histogram[i];
+			if (seen > threshold)
+				return rtt_bucket_bounds_us[i];
+		}
+
+		return INT64_MAX;
+	}
+
+	// State is stale once it has been received at least once, but the server hasn't been heard from
+	// within the budget
+	static bool isStateStale()
+	{
+		// Without the heartbeat (e.g. state fed in offline) there is no connection to go stale
+		if (!worker_running || !has_state)
+			return false;
+
+		if (webSocket.getReadyState() != ix::ReadyState::Open)
+			return true;
+
+		return getTimeNs() - last_contact_ns > (int64_t)stall_budget_ms * 1000000;
 	}
 
 	static std::string getWebsocketStatus()
@@ -92,10 +652,26 @@ public:
 		}
 		}
 
+		int64_t rtt_us = last_rtt_us;
+		if (rtt_us >= 0) {
+			char rtt[64];
+			int64_t p95_us = getRttPercentileUs(0.95);
+
+			if (p95_us == INT64_MAX) {
+				snprintf(rtt, sizeof(rtt), " (RTT: %.1f ms, p95: > %.1f ms)", rtt_us / 1000.0,
+					 rtt_bucket_bounds_us[RTT_BUCKET_COUNT - 2] / 1000.0);
+			} else {
+				snprintf(rtt, sizeof(rtt), " (RTT: %.1f ms, p95: < %.1f ms)", rtt_us / 1000.0,
+					 p95_us / 1000.0);
+			}
+
+			status.append(rtt);
+		}
+
 		return status;
 	}
 
-	static int getRandomID() { return rand() % 420 + 69; }
+	static int getNextRequestID() { return next_request_id++; }
 
 	static void refreshInputsAndOutputs()
 	{
@@ -108,89 +684,395 @@ public:
 			return;
 		}
 
-		sendGetInputConfigsMessage();
-		sendGetOutputConfigMessage();
+		sendFullStateRequest();
 	}
 
-	static void sendGetInputConfigsMessage()
+	// Writes an unsigned integer in the smallest CBOR or MessagePack encoding
+	static void appendBinaryUint(std::string &buffer, MessageCodec message_codec, uint32_t value)
+	{
+		if (message_codec == MessageCodec::CBOR) {
+			if (value < 24) {
+				buffer.push_back((char)value);
+			} else if (value <= 0xFF) {
+				buffer.push_back((char)0x18);
+				buffer.push_back((char)value);
+			} else if (value <= 0xFFFF) {
+				buffer.push_back((char)0x19);
+				buffer.push_back((char)(value >> 8));
+				buffer.push_back((char)value);
+			} else {
+				buffer.push_back((char)0x1A);
+				for (int shift = 24; shift >= 0; shift -= 8)
+					buffer.push_back((char)(value >> shift));
+			}
+			return;
+		}
+
+		if (value < 128) {
+			buffer.push_back((char)value);
+		} else if (value <= 0xFF) {
+			buffer.push_back((char)0xCC);
+			buffer.push_back((char)value);
+		} else if (value <= 0xFFFF) {
+			buffer.push_back((char)0xCD);
+			buffer.push_back((char)(value >> 8));
+			buffer.push_back((char)value);
+		} else {
+			buffer.push_back((char)0xCE);
+			for (int shift = 24; shift >= 0; shift -= 8)
+				buffer.push_back((char)(value >> shift));
+		}
+	}
+
+	static void appendBinaryString(std::string &buffer, MessageCodec message_codec, std::string_view value)
+	{
+		size_t length = value.size();
+
+		if (message_codec == MessageCodec::CBOR) {
+			if (length < 24) {
+				buffer.push_back((char)(0x60 | length));
+			} else if (length <= 0xFF) {
+				buffer.push_back((char)0x78);
+				buffer.push_back((char)length);
+			} else {
+				buffer.push_back((char)0x79);
+				buffer.push_back((char)(length >> 8));
+				buffer.push_back((char)length);
+			}
+		} else {
+			if (length < 32) {
+				buffer.push_back((char)(0xA0 | length));
+			} else if (length <= 0xFF) {
+				buffer.push_back((char)0xD9);
+				buffer.push_back((char)length);
+			} else {
+				buffer.push_back((char)0xDA);
+				buffer.push_back((char)(length >> 8));
+				buffer.push_back((char)length);
+			}
+		}
+
+		buffer.append(value.substr(0, 0xFFFF));
+	}
+
+	static void appendBinaryBool(std::string &buffer, MessageCodec message_codec, bool value)
+	{
+		if (message_codec == MessageCodec::CBOR) {
+			buffer.push_back(value ? (char)0xF5 : (char)0xF4);
+		} else {
+			buffer.push_back(value ? (char)0xC3 : (char)0xC2);
+		}
+	}
+
+	static void appendJsonString(std::string &buffer, std::string_view value)
 	{
-		input_configs_id = getRandomID();
+		buffer.push_back('"');
+
+		for (char c : value) {
+			if (c == '"' || c == '\\') {
+				buffer.push_back('\\');
+				buffer.push_back(c);
+			} else if ((unsigned char)c < 0x20) {
+				char escaped[8];
+				snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)c);
+				buffer.append(escaped);
+			} else {
+				buffer.push_back(c);
+			}
+		}
 
-		auto json = nlohmann::json();
-		json["jsonrpc"] = "2.0";
-		json["method"] = "getInputConfigs";
-		json["id"] = input_configs_id;
+		buffer.push_back('"');
+	}
 
-		webSocket.send(json.dump());
+	// With has_params the request is left open for its "params" value, which the caller appends
+	// (and closes with '}' for JSON text)
+	static void appendRequest(std::string &buffer, MessageCodec message_codec,
+				  const RequestTemplate &request_template, int id, bool has_params = false)
+	{
+		switch (message_codec) {
+		case MessageCodec::JSON_TEXT: {
+			char id_chars[16];
+			char *end = std::to_chars(id_chars, id_chars + sizeof(id_chars), id).ptr;
+
+			buffer.append(request_template.json_prefix);
+			buffer.append(id_chars, end);
+			buffer.append(has_params ? R"(,"params":)" : "}");
+			break;
+		}
+		case MessageCodec::CBOR: {
+			// Map with 3 (or 4) entries, then the text key "id"
+			buffer.append(has_params ? "\xA4\x62id" : "\xA3\x62id", 4);
+			appendBinaryUint(buffer, message_codec, (uint32_t)id);
+			buffer.append(request_template.cbor_body);
+
+			if (has_params)
+				appendBinaryString(buffer, message_codec, "params");
+			break;
+		}
+		case MessageCodec::MSGPACK: {
+			// Map with 3 (or 4) entries, then the string key "id"
+			buffer.append(has_params ? "\x84\xA2id" : "\x83\xA2id", 4);
+			appendBinaryUint(buffer, message_codec, (uint32_t)id);
+			buffer.append(request_template.msgpack_body);
+
+			if (has_params)
+				appendBinaryString(buffer, message_codec, "params");
+			break;
+		}
+		}
+	}
+
+	static void sendRequest(const RequestTemplate &request_template, int id)
+	{
+		std::lock_guard<std::mutex> lock(request_mutex);
+		MessageCodec message_codec = codec;
+
+		request_buffer.clear();
+		appendRequest(request_buffer, message_codec, request_template, id);
+
+		webSocket.send(request_buffer, message_codec != MessageCodec::JSON_TEXT);
+	}
+
+	static void sendBatchRequest(std::initializer_list<std::pair<const RequestTemplate *, int>> requests)
+	{
+		std::lock_guard<std::mutex> lock(request_mutex);
+		MessageCodec message_codec = codec;
+
+		request_buffer.clear();
+
+		// Batches are tiny, so the array header always fits into a single byte
+		if (message_codec == MessageCodec::JSON_TEXT) {
+			request_buffer.push_back('[');
+		} else if (message_codec == MessageCodec::CBOR) {
+			request_buffer.push_back((char)(0x80 | requests.size()));
+		} else {
+			request_buffer.push_back((char)(0x90 | requests.size()));
+		}
+
+		bool first = true;
+		for (auto &[request_template, id] : requests) {
+			if (!first && message_codec == MessageCodec::JSON_TEXT)
+				request_buffer.push_back(',');
+
+			appendRequest(request_buffer, message_codec, *request_template, id);
+			first = false;
+		}
+
+		if (message_codec == MessageCodec::JSON_TEXT)
+			request_buffer.push_back(']');
+
+		webSocket.send(request_buffer, message_codec != MessageCodec::JSON_TEXT);
+	}
+
+	static void sendGetInputConfigsMessage()
+	{
+		input_configs_id = getNextRequestID();
+
+		sendRequest(input_configs_request, input_configs_id);
 	}
 
 	static void sendGetOutputConfigMessage()
 	{
-		output_config_id = getRandomID();
+		output_config_id = getNextRequestID();
+
+		sendRequest(output_config_request, output_config_id);
+	}
+
+	static void sendFullStateRequest()
+	{
+		if (batch_support == BatchSupport::SUPPORTED) {
+			input_configs_id = getNextRequestID();
+			output_config_id = getNextRequestID();
+
+			sendBatchRequest({{&input_configs_request, input_configs_id},
+					  {&output_config_request, output_config_id}});
+			return;
+		}
+
+		sendGetInputConfigsMessage();
+		sendGetOutputConfigMessage();
 
-		auto json = nlohmann::json();
-		json["jsonrpc"] = "2.0";
-		json["method"] = "getOutputConfig";
-		json["id"] = output_config_id;
+		if (batch_support == BatchSupport::UNKNOWN) {
+			// Single-entry batch to find out if the server handles them. Real Wave Link may just ignore it,
+			// which is fine since the separate requests above already cover the state.
+			batch_probe_id = getNextRequestID();
 
-		webSocket.send(json.dump());
+			sendBatchRequest({{&output_config_request, batch_probe_id}});
+		}
 	}
 
-	static Channel *getChannel(std::string identifier)
+	// Called with channels_mutex held
+	static Channel *getChannel(const std::string &identifier)
 	{
-		if (!channels.count(identifier))
+		auto it = channels.find(identifier);
+		if (it == channels.end())
 			return nullptr;
 
-		return channels[identifier];
+		return it->second;
 	}
 
+	static bool isValidMixer(MixerType mixer_type)
+	{
+		return mixer_type > MixerType::INVALID && mixer_type < mixer_count;
+	}
+
+	static int getMixerCount() { return mixer_count; }
+
 	static Mixer *getOutput(MixerType mixer_type)
 	{
-		if (!mixers.count(mixer_type)) {
-			mixers[mixer_type] = new Mixer();
-		}
+		if (!isValidMixer(mixer_type))
+			return nullptr;
 
-		return mixers[mixer_type];
+		return &mixers[mixer_type];
 	}
 
-	static bool getMixerMutedStatus(MixerType mixer_type)
+	static bool isMixerConfig(const std::string &key, const nlohmann::json &value)
 	{
-		if (mixer_type == MixerType::EITHER) {
-			for (auto &mixer : mixers) {
-				if (mixer.second->muted) {
-					return true;
-				}
-			}
-			return false;
+		return key.size() > 5 && key.compare(key.size() - 5, 5, "Mixer") == 0 && value.is_array() &&
+		       value.size() >= 2 && value[0].is_boolean() && value[1].is_number();
+	}
+
+	// Looks up the mixer for a config key like "localMixer", adding it to the table if it's new
+	static MixerType getOrAddMixer(const std::string &config_key)
+	{
+		std::string mix = config_key.substr(0, config_key.size() - 5);
+		std::string id = "com.elgato.mix." + mix;
+
+		auto it = mixer_indices.find(id);
+		if (it != mixer_indices.end())
+			return static_cast<MixerType>(it->second);
+
+		int index = mixer_count;
+		if (index >= MAX_MIXERS) {
+			obs_log(LOG_WARNING, "Ignoring mixer %s, there are already %d mixers", id.c_str(),
+				MAX_MIXERS - 1);
+			return MixerType::INVALID;
 		}
 
-		if (!mixers.count(mixer_type)) {
-			mixers[mixer_type] = new Mixer();
+		Mixer &mixer = mixers[index];
+		mixer.id = id;
+		mixer.config_key = config_key;
+		mixer.name = mix + " Mix";
+		mixer.name[0] = (char)toupper((unsigned char)mixer.name[0]);
+
+		mixer_indices[id] = index;
+		mixer_count = index + 1;
+
+		obs_log(LOG_INFO, "Discovered mixer %s (%s)", mixer.name.c_str(), id.c_str());
+
+		resolveAllFilterMixers();
+
+		return static_cast<MixerType>(index);
+	}
+
+	// Safe from any thread, unlike mixer_indices
+	static MixerType findMixer(const std::string &id)
+	{
+		if (id == MIXER_ID_EITHER)
+			return MixerType::EITHER;
+
+		int count = mixer_count;
+		for (int i = MixerType::LOCAL; i < count; i++) {
+			if (mixers[i].id == id)
+				return static_cast<MixerType>(i);
 		}
 
-		return mixers[mixer_type]->muted;
+		return MixerType::INVALID;
 	}
 
-	static bool getChannelMutedStatus(Channel *channel, MixerType mixer_type)
+	static void registerFilter(filter_t *filter)
 	{
-		if (mixer_type == MixerType::EITHER) {
-			for (auto &[mixer, status] : channel->muted) {
-				if (status) {
-					return true;
-				}
-			}
+		std::lock_guard<std::mutex> lock(filters_mutex);
+		filters.insert(filter);
+	}
+
+	static void unregisterFilter(filter_t *filter)
+	{
+		std::lock_guard<std::mutex> lock(filters_mutex);
+		filters.erase(filter);
+	}
+
+	// A mixer that hasn't been discovered yet resolves to INVALID until it is
+	static void setFilterMixerIDs(filter_t *filter, const std::string &volume_mixer_id,
+				      const std::string &channel_mixer_mute_id,
+				      const std::string &apply_mixer_volume_id,
+				      const std::string &follow_mixer_mute_id)
+	{
+		std::lock_guard<std::mutex> lock(filters_mutex);
+
+		filter->volume_mixer_id = volume_mixer_id;
+		filter->channel_mixer_mute_id = channel_mixer_mute_id;
+		filter->apply_mixer_volume_id = apply_mixer_volume_id;
+		filter->follow_mixer_mute_id = follow_mixer_mute_id;
+
+		resolveFilterMixers(filter);
+	}
+
+	// Called with filters_mutex held
+	static void resolveFilterMixers(filter_t *filter)
+	{
+		filter->volume_mixer_type = findMixer(filter->volume_mixer_id);
+		filter->channel_mixer_mute_type = findMixer(filter->channel_mixer_mute_id);
+		filter->apply_mixer_volume_type = findMixer(filter->apply_mixer_volume_id);
+		filter->follow_mixer_mute_type = findMixer(filter->follow_mixer_mute_id);
+	}
+
+	static void resolveAllFilterMixers()
+	{
+		std::lock_guard<std::mutex> lock(filters_mutex);
+
+		for (auto filter : filters)
+			resolveFilterMixers(filter);
+	}
+
+	static void updateMixerMutedAggregate()
+	{
+		bool muted = false;
+		for (int i = MixerType::LOCAL; i < mixer_count; i++)
+			muted = muted || mixers[i].muted;
+
+		any_mixer_muted = muted;
+	}
+
+	static void updateChannelMutedAggregate(Channel *channel)
+	{
+		bool muted = false;
+		for (int i = MixerType::LOCAL; i < mixer_count; i++)
+			muted = muted || channel->muted[i];
+
+		channel->any_muted = muted;
+	}
+
+	static bool getMixerMutedStatus(MixerType mixer_type)
+	{
+		if (mixer_type == MixerType::EITHER)
+			return any_mixer_muted;
+
+		if (!isValidMixer(mixer_type))
+			return false;
+
+		return mixers[mixer_type].muted;
+	}
+
+	static bool getChannelMutedStatus(const Channel *channel, MixerType mixer_type)
+	{
+		if (mixer_type == MixerType::EITHER)
+			return channel->any_muted;
+
+		if (!isValidMixer(mixer_type))
 			return false;
-		}
 
 		return channel->muted[mixer_type];
 	}
 
-	static std::vector<Channel *> getChannels()
+	// Copies, the channels themselves can go away as soon as the lock is released
+	static std::vector<Channel> getChannels()
 	{
-		std::vector<Channel *> channel_values;
+		std::shared_lock<std::shared_mutex> lock(channels_mutex);
+		std::vector<Channel> channel_values;
 
 		for (auto it = channels.begin(); it != channels.end(); ++it) {
-			channel_values.push_back(it->second);
+			channel_values.push_back(*it->second);
 		}
 
 		return channel_values;
@@ -203,11 +1085,16 @@ public:
 		if (!json.contains("result"))
 			return;
 
+		has_state = true;
+
+		std::unique_lock<std::shared_mutex> lock(channels_mutex);
+
+		for (auto &[identifier, channel] : channels)
+			delete channel;
 		channels.clear();
 
 		for (auto &json_input : json["result"]) {
-			if (!json_input.contains("identifier") || !json_input.contains("name") ||
-			    !json_input.contains("localMixer") || !json_input.contains("streamMixer"))
+			if (!json_input.contains("identifier") || !json_input.contains("name"))
 				continue;
 
 			std::string identifier = json_input["identifier"];
@@ -215,17 +1102,29 @@ public:
 			auto channel = channels[identifier] = new Channel{identifier = identifier};
 			channel->name = json_input["name"];
 
-			channel->muted[MixerType::LOCAL] = json_input["localMixer"][0];
-			channel->volume[MixerType::LOCAL] = json_input["localMixer"][1];
+			for (auto &[key, value] : json_input.items()) {
+				if (!isMixerConfig(key, value))
+					continue;
 
-			channel->muted[MixerType::STREAM] = json_input["streamMixer"][0];
-			channel->volume[MixerType::STREAM] = json_input["streamMixer"][1];
+				MixerType mixerType = getOrAddMixer(key);
+				if (mixerType == MixerType::INVALID)
+					continue;
 
-			obs_log(LOG_DEBUG, "input, %s, %s, %d, %d, %d, %d - volumes size: %d",
-				channel->identifier.c_str(), channel->name.c_str(), channel->muted[MixerType::LOCAL],
-				channel->volume[MixerType::LOCAL], channel->muted[MixerType::STREAM],
-				channel->volume[MixerType::STREAM], channels.size());
+				channel->muted[mixerType] = value[0];
+				channel->volume[mixerType] = value[1];
+
+				obs_log(LOG_DEBUG, "input, %s, %s, %s, %d, %d", channel->identifier.c_str(),
+					channel->name.c_str(), key.c_str(), channel->muted[mixerType],
+					channel->volume[mixerType]);
+			}
+
+			updateChannelMutedAggregate(channel);
 		}
+
+		obs_log(LOG_DEBUG, "inputs size: %d", channels.size());
+
+		lock.unlock();
+		queueParentSync("");
 	}
 
 	static void handleOutputConfig(nlohmann::json json)
@@ -237,40 +1136,51 @@ public:
 
 		auto result = json["result"];
 
-		if (!result.contains("localMixer") || !result.contains("streamMixer"))
+		if (!result.is_object())
 			return;
 
-		Mixer *localOutput = getOutput(MixerType::LOCAL);
-		Mixer *streamOutput = getOutput(MixerType::STREAM);
+		for (auto &[key, value] : result.items()) {
+			if (!isMixerConfig(key, value))
+				continue;
 
-		localOutput->muted = result["localMixer"][0];
-		localOutput->volume = result["localMixer"][1];
+			Mixer *output = getOutput(getOrAddMixer(key));
+			if (!output)
+				continue;
 
-		streamOutput->muted = result["streamMixer"][0];
-		streamOutput->volume = result["streamMixer"][1];
+			has_state = true;
 
-		obs_log(LOG_DEBUG, "outputs, %d, %d, %d, %d", localOutput->muted, localOutput->volume,
-			streamOutput->muted, streamOutput->volume);
+			output->muted = value[0];
+			output->volume = value[1];
+
+			obs_log(LOG_DEBUG, "output, %s, %d, %d", output->id.c_str(), output->muted, output->volume);
+		}
+
+		updateMixerMutedAggregate();
 	}
 
-	static MixerType getMixerFromParams(nlohmann::json params)
+	static const std::string &getMixerID(MixerType mixer_type)
 	{
-		MixerType mixerType = MixerType::INVALID;
+		static const std::string no_mixer_id;
+
+		if (!isValidMixer(mixer_type))
+			return no_mixer_id;
 
+		return mixers[mixer_type].id;
+	}
+
+	// Anything that isn't a known mixer (like com.elgato.mix.microphoneFX) comes back as INVALID
+	static MixerType getMixerFromParams(nlohmann::json params)
+	{
 		if (!params.contains("mixerID"))
-			return mixerType;
+			return MixerType::INVALID;
 
 		std::string mixerID = params["mixerID"];
-		if (mixerID == "com.elgato.mix.microphoneFX")
-			return mixerType;
 
-		if (mixerID == "com.elgato.mix.local") {
-			mixerType = MixerType::LOCAL;
-		} else if (mixerID == "com.elgato.mix.stream") {
-			mixerType = MixerType::STREAM;
-		}
+		auto it = mixer_indices.find(mixerID);
+		if (it == mixer_indices.end())
+			return MixerType::INVALID;
 
-		return mixerType;
+		return static_cast<MixerType>(it->second);
 	}
 
 	static void handleOutputVolumeChanged(nlohmann::json params)
@@ -309,6 +1219,7 @@ public:
 		Mixer *output = getOutput(mixerType);
 
 		output->muted = muted;
+		updateMixerMutedAggregate();
 
 		obs_log(LOG_DEBUG, "Output %d, %s", mixerType, muted ? "Muted" : "Unmuted");
 	}
@@ -328,7 +1239,11 @@ public:
 		if (mixerType == MixerType::INVALID)
 			return;
 
+		if (isOwnEcho(identifier, mixerType, false, volume))
+			return;
+
 		updateFilterVolume(identifier, mixerType, volume);
+		queueParentSync(identifier);
 
 		obs_log(LOG_DEBUG, "%s, %d, Volume: %d", identifier.c_str(), mixerType, volume);
 	}
@@ -348,7 +1263,11 @@ public:
 		if (mixerType == MixerType::INVALID)
 			return;
 
+		if (isOwnEcho(identifier, mixerType, true, muted))
+			return;
+
 		updateFilterMuted(identifier, mixerType, muted);
+		queueParentSync(identifier);
 
 		obs_log(LOG_DEBUG, "%s, %d, %s", identifier.c_str(), mixerType, muted ? "Muted" : "Unmuted");
 	}
@@ -364,6 +1283,8 @@ public:
 
 		std::string name = params["value"];
 
+		std::unique_lock<std::shared_mutex> lock(channels_mutex);
+
 		Channel *channel = getChannel(identifier);
 		if (!channel)
 			return;
@@ -373,16 +1294,88 @@ public:
 		obs_log(LOG_DEBUG, "%s, %s", identifier.c_str(), name.c_str());
 	}
 
+	static void handleResponse(nlohmann::json json)
+	{
+		if (!json["id"].is_number_integer())
+			return;
+
+		int id = json["id"].get<int>();
+
+		if (id == input_configs_id) {
+			handleInputConfigs(json);
+		} else if (id == output_config_id || id == batch_probe_id) {
+			handleOutputConfig(json);
+		}
+	}
+
+	static void handleBatchResponse(nlohmann::json json)
+	{
+		if (batch_support != BatchSupport::SUPPORTED) {
+			obs_log(LOG_INFO, "Server supports batched requests");
+			batch_support = BatchSupport::SUPPORTED;
+		}
+
+		for (auto &entry : json) {
+			if (entry.is_object() && entry.contains("id") && entry.contains("result"))
+				handleResponse(entry);
+		}
+	}
+
+	static void handleBatchError()
+	{
+		// A batch that couldn't be handled as a whole comes back as a single error without an ID
+		BatchSupport previous_support = batch_support;
+
+		obs_log(LOG_INFO, "Server rejected batched request, falling back to separate requests");
+		batch_support = BatchSupport::UNSUPPORTED;
+
+		if (previous_support == BatchSupport::SUPPORTED) {
+			sendGetInputConfigsMessage();
+			sendGetOutputConfigMessage();
+		}
+	}
+
+	static void handleBinaryWebsocketMessage(const std::string &data)
+	{
+		nlohmann::json json;
+
+		if (codec == MessageCodec::CBOR) {
+			json = nlohmann::json::from_cbor(data, true, false);
+		} else if (codec == MessageCodec::MSGPACK) {
+			json = nlohmann::json::from_msgpack(data, true, false);
+		} else {
+			obs_log(LOG_WARNING, "Ignoring binary message, no binary subprotocol was negotiated");
+			return;
+		}
+
+		if (json.is_discarded()) {
+			obs_log(LOG_WARNING, "Ignoring binary message that couldn't be decoded");
+			return;
+		}
+
+		handleMessage(json);
+	}
+
 	static void handleWebsocketMessage(std::string text)
 	{
-		auto json = nlohmann::json::parse(text);
+		handleMessage(nlohmann::json::parse(text));
+	}
+
+	static void handleMessage(nlohmann::json json)
+	{
+		if (json.is_array()) {
+			handleBatchResponse(json);
+			return;
+		}
+
+		if (json.contains("error") && json.contains("id") && json["id"].is_null()) {
+			if (batch_support != BatchSupport::UNSUPPORTED)
+				handleBatchError();
+			return;
+		}
 
 		if (json.contains("id") && json.contains("result")) {
-			if (json["id"] == input_configs_id) {
-				handleInputConfigs(json);
-			} else if (json["id"] == output_config_id) {
-				handleOutputConfig(json);
-			}
+			handleResponse(json);
 			return;
 		}
 
@@ -414,8 +1407,10 @@ public:
 
 	static void updateFilterVolume(std::string identifier, MixerType mixer_type, int volume)
 	{
+		std::unique_lock<std::shared_mutex> lock(channels_mutex);
+
 		Channel *channel = getChannel(identifier);
-		if (!channel)
+		if (!channel || !isValidMixer(mixer_type))
 			return;
 
 		channel->volume[mixer_type] = volume;
@@ -423,11 +1418,100 @@ public:
 
 	static void updateFilterMuted(std::string identifier, MixerType mixer_type, bool muted)
 	{
+		std::unique_lock<std::shared_mutex> lock(channels_mutex);
+
 		Channel *channel = getChannel(identifier);
-		if (!channel)
+		if (!channel || !isValidMixer(mixer_type))
 			return;
 
 		channel->muted[mixer_type] = muted;
+		updateChannelMutedAggregate(channel);
+	}
+
+	static bool isApplyingToParent() { return applying_to_parent; }
+
+	// Filters that push OBS changes carry the channel volume and mute on their source's own fader and mute, so
+	// changes from Wave Link go there instead of into the filter's gain. Sources can only be changed from the
+	// UI thread. An empty identifier syncs every channel.
+	static void queueParentSync(const std::string &identifier)
+	{
+		if (!hasPushingFilter())
+			return;
+
+		obs_queue_task(OBS_TASK_UI, syncParentsTask, new std::string(identifier), false);
+	}
+
+	static bool hasPushingFilter()
+	{
+		std::lock_guard<std::mutex> lock(filters_mutex);
+
+		for (auto filter : filters) {
+			if (filter->push_obs_changes)
+				return true;
+		}
+
+		return false;
+	}
+
+	static void syncParentsTask(void *param)
+	{
+		std::unique_ptr<std::string> identifier((std::string *)param);
+
+		// Copied first, filters_mutex is taken while channels_mutex is held when mixers are discovered
+		std::vector<Channel> channel_copies = getChannels();
+
+		std::lock_guard<std::mutex> lock(filters_mutex);
+
+		for (auto &channel : channel_copies) {
+			if (!identifier->empty() && channel.identifier != *identifier)
+				continue;
+
+			for (auto filter : filters) {
+				if (filter->channel == channel.identifier)
+					applyChannelToParent(filter, channel);
+			}
+		}
+	}
+
+	// UI thread only, for a filter that was just set up or attached to its source
+	static void syncFilterParent(filter_t *filter)
+	{
+		Channel channel;
+
+		{
+			std::shared_lock<std::shared_mutex> lock(channels_mutex);
+
+			Channel *found = getChannel(filter->channel);
+			if (!found)
+				return;
+
+			channel = *found;
+		}
+
+		applyChannelToParent(filter, channel);
+	}
+
+	static void applyChannelToParent(filter_t *filter, const Channel &channel)
+	{
+		if (!filter->push_obs_changes || !filter->parent)
+			return;
+
+		MixerType volume_mixer_type = static_cast<MixerType>(filter->volume_mixer_type);
+		MixerType channel_mixer_mute_type = static_cast<MixerType>(filter->channel_mixer_mute_type);
+		bool muted = getChannelMutedStatus(&channel, channel_mixer_mute_type);
+
+		applying_to_parent = true;
+
+		if (isValidMixer(volume_mixer_type)) {
+			float volume = obs_db_to_mul(interpolate_volume_db((float)channel.volume[volume_mixer_type]));
+			if (fabsf(obs_source_get_volume(filter->parent) - volume) > 0.0001f)
+				obs_source_set_volume(filter->parent, volume);
+		}
+
+		if (obs_source_muted(filter->parent) != muted)
+			obs_source_set_muted(filter->parent, muted);
+
+		applying_to_parent = false;
 	}
 
 	static int getMixerVolumeForFilter(filter_t *filter)
@@ -446,10 +1530,26 @@ public:
 			return 0;
 		}
 
+		if (!volume_output)
+			return 100;
+
 		return volume_output->volume;
 	}
 
+	// Called from audio threads, so it never waits for channels_mutex. While the channels are being rebuilt
+	// the filter keeps the volume it had on its previous tick.
 	static int getChannelVolumeForFilter(filter_t *filter)
+	{
+		std::shared_lock<std::shared_mutex> lock(channels_mutex, std::try_to_lock);
+		if (!lock.owns_lock())
+			return filter->channel_volume;
+
+		filter->channel_volume = resolveChannelVolumeForFilter(filter);
+		return filter->channel_volume;
+	}
+
+	// Called with channels_mutex held
+	static int resolveChannelVolumeForFilter(filter_t *filter)
 	{
 		if (filter->channel == "None")
 			return 100;
@@ -467,6 +1567,14 @@ public:
 			return 0;
 		}
 
+		// The channel volume is on the source's own OBS fader (see applyChannelToParent), applying it here as
+		// well would square it
+		if (filter->push_obs_changes)
+			return 100;
+
+		if (!isValidMixer(volume_mixer_type))
+			return 100;
+
 		return channel->volume[volume_mixer_type];
 	}
 };
\ No newline at end of file
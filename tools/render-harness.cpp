@@ -0,0 +1,335 @@
+/*
+Offline render harness for the Wave Link Sync filter.
+
+Feeds a WAV file through filter_handle_audio in OBS-sized planar chunks while a scripted
+Wave Link state timeline plays, writes the result and optionally compares it against a golden file.
+With --bench it also reports the throughput as a multiple of realtime for the OBS channel layouts.
+
+Usage:
+  wavelink-sync-render --input <in.wav> --timeline <timeline.json> [--output <out.wav>]
+                       [--golden <golden.wav>] [--tolerance <max abs difference>] [--bench]
+
+The timeline is a JSON object with the filter settings (same keys as the filter properties)
+and a list of events, each applied before the first chunk that starts at or after its time:
+
+{
+	"settings": { "channel": "audio_device_id_0", "volume_mixer_id": "com.elgato.mix.local" },
+	"events": [
+		{ "time": 0.0, "inputConfigs": [ { "identifier": "audio_device_id_0", ... } ] },
+		{ "time": 0.0, "outputConfig": { "localMixer": [false, 100], "streamMixer": [false, 100] } },
+		{ "time": 1.5, "message": { "method": "inputVolumeChanged", "params": { ... } } }
+	]
+}
+
+"inputConfigs" and "outputConfig" carry what would be the "result" of the respective response,
+"message" is any notification Wave Link would send.
+*/
+
+#include <obs.h>
+#include <plugin-support.h>
+
+#include <websocket.hpp>
+
+#include "wav-file.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+
+extern "C" const char *obs_module_text(const char *lookup_string)
+{
+	return lookup_string;
+}
+
+extern void filter_get_defaults(obs_data_t *defaults);
+extern void *filter_create(obs_data_t *settings, obs_source_t *obs_source);
+extern void filter_destroy(void *data);
+extern obs_audio_data *filter_handle_audio(void *data, obs_audio_data *audio);
+
+// Channel counts OBS has speaker layouts for
+static const size_t bench_layouts[] = {1, 2, 3, 4, 5, 6, 8};
+
+#define BENCH_MIN_SECONDS 0.25
+
+struct TimelineEvent {
+	double time;
+	nlohmann::json event;
+};
+
+struct Timeline {
+	std::string settings_json;
+	std::vector<TimelineEvent> events;
+};
+
+static bool load_timeline(const std::string &path, Timeline &timeline, std::string &error)
+{
+	std::ifstream file(path);
+	if (!file) {
+		error = "Couldn't open " + path;
+		return false;
+	}
+
+	auto json = nlohmann::json::parse(file, nullptr, false);
+	if (json.is_discarded() || !json.is_object()) {
+		error = path + " is not a valid timeline";
+		return false;
+	}
+
+	timeline.settings_json = json.contains("settings") ? json["settings"].dump() : "{}";
+
+	if (json.contains("events")) {
+		for (auto &event : json["events"]) {
+			timeline.events.push_back({event.value("time", 0.0), event});
+		}
+	}
+
+	std::stable_sort(timeline.events.begin(), timeline.events.end(),
+			 [](const TimelineEvent &a, const TimelineEvent &b) { return a.time < b.time; });
+
+	return true;
+}
+
+static void apply_event(const nlohmann::json &event)
+{
+	if (event.contains("inputConfigs")) {
+		WebSocketHandler::handleInputConfigs({{"result", event["inputConfigs"]}});
+	}
+
+	if (event.contains("outputConfig")) {
+		WebSocketHandler::handleOutputConfig({{"result", event["outputConfig"]}});
+	}
+
+	if (event.contains("message")) {
+		WebSocketHandler::handleWebsocketMessage(event["message"].dump());
+	}
+}
+
+// Renders the input with the given channel count (input channels are repeated to fill it)
+// and returns the time spent inside filter_handle_audio in seconds
+static double render(const WavData &input, const Timeline &timeline, size_t channels, WavData &output)
+{
+	obs_data_t *settings = obs_data_create_from_json(timeline.settings_json.c_str());
+	filter_get_defaults(settings);
+
+	auto filter = (filter_t *)filter_create(settings, nullptr);
+	filter->channels = channels;
+	filter->sample_rate = input.sample_rate;
+
+	obs_data_release(settings);
+
+	output.sample_rate = input.sample_rate;
+	output.channels = channels;
+	output.frames = input.frames;
+	output.samples.resize(input.frames * channels);
+
+	std::vector<std::vector<float>> planes(channels, std::vector<float>(AUDIO_OUTPUT_FRAMES));
+
+	size_t next_event = 0;
+	std::chrono::steady_clock::duration elapsed{};
+
+	for (size_t start = 0; start < input.frames; start += AUDIO_OUTPUT_FRAMES) {
+		size_t frames = std::min((size_t)AUDIO_OUTPUT_FRAMES, input.frames - start);
+		double start_time = (double)start / input.sample_rate;
+
+		while (next_event < timeline.events.size() && timeline.events[next_event].time <= start_time) {
+			apply_event(timeline.events[next_event].event);
+			next_event++;
+		}
+
+		obs_audio_data audio = {};
+		audio.frames = (uint32_t)frames;
+		audio.timestamp = (uint64_t)(start_time * 1000000000.0);
+
+		for (size_t c = 0; c < channels; c++) {
+			size_t input_channel = c % input.channels;
+
+			for (size_t i = 0; i < frames; i++) {
+				planes[c][i] = input.samples[(start + i) * input.channels + input_channel];
+			}
+
+			audio.data[c] = (uint8_t *)planes[c].data();
+		}
+
+		auto before = std::chrono::steady_clock::now();
+		filter_handle_audio(filter, &audio);
+		elapsed += std::chrono::steady_clock::now() - before;
+
+		for (size_t c = 0; c < channels; c++) {
+			for (size_t i = 0; i < frames; i++) {
+				output.samples[(start + i) * channels + c] = planes[c][i];
+			}
+		}
+	}
+
+	filter_destroy(filter);
+
+	return std::chrono::duration<double>(elapsed).count();
+}
+
+static bool compare(const WavData &output, const WavData &golden, double tolerance)
+{
+	if (output.channels != golden.channels || output.frames != golden.frames) {
+		printf("FAIL: golden file has %zu channels and %zu frames, output has %zu channels and %zu frames\n",
+		       golden.channels, golden.frames, output.channels, output.frames);
+		return false;
+	}
+
+	size_t mismatches = 0;
+	size_t first_mismatch = 0;
+	double max_difference = 0.0;
+
+	for (size_t i = 0; i < output.samples.size(); i++) {
+		float a = output.samples[i];
+		float b = golden.samples[i];
+		double difference = std::fabs((double)a - (double)b);
+
+		bool equal = tolerance > 0.0 ? difference <= tolerance : memcmp(&a, &b, sizeof(float)) == 0;
+		if (!equal) {
+			if (mismatches == 0)
+				first_mismatch = i;
+			mismatches++;
+		}
+
+		max_difference = std::max(max_difference, difference);
+	}
+
+	if (mismatches > 0) {
+		printf("FAIL: %zu samples differ, first at frame %zu channel %zu, max difference %g\n", mismatches,
+		       first_mismatch / output.channels, first_mismatch % output.channels, max_difference);
+		return false;
+	}
+
+	printf("PASS: output matches golden file (%s, max difference %g)\n",
+	       tolerance > 0.0 ? "within tolerance" : "bit-exact", max_difference);
+	return true;
+}
+
+static void bench(const WavData &input, const Timeline &timeline)
+{
+	double duration = (double)input.frames / input.sample_rate;
+
+	printf("\n%-10s %16s %16s\n", "Channels", "ns/frame", "x realtime");
+
+	for (size_t channels : bench_layouts) {
+		WavData output;
+		double elapsed = 0.0;
+		size_t runs = 0;
+
+		while (elapsed < BENCH_MIN_SECONDS) {
+			elapsed += render(input, timeline, channels, output);
+			runs++;
+		}
+
+		double ns_per_frame = elapsed * 1000000000.0 / ((double)input.frames * runs);
+		double realtime_factor = duration * runs / elapsed;
+
+		printf("%-10zu %16.2f %16.1f\n", channels, ns_per_frame, realtime_factor);
+	}
+}
+
+static void print_usage()
+{
+	printf("Usage: wavelink-sync-render --input <in.wav> --timeline <timeline.json> [--output <out.wav>]\n"
+	       "                            [--golden <golden.wav>] [--tolerance <value>] [--bench]\n");
+}
+
+int main(int argc, char **argv)
+{
+	std::string input_path;
+	std::string timeline_path;
+	std::string output_path;
+	std::string golden_path;
+	double tolerance = 0.0;
+	bool run_bench = false;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+
+		if (arg == "--input" && has_value) {
+			input_path = argv[++i];
+		} else if (arg == "--timeline" && has_value) {
+			timeline_path = argv[++i];
+		} else if (arg == "--output" && has_value) {
+			output_path = argv[++i];
+		} else if (arg == "--golden" && has_value) {
+			golden_path = argv[++i];
+		} else if (arg == "--tolerance" && has_value) {
+			tolerance = atof(argv[++i]);
+		} else if (arg == "--bench") {
+			run_bench = true;
+		} else {
+			print_usage();
+			return 2;
+		}
+	}
+
+	if (input_path.empty() || timeline_path.empty()) {
+		print_usage();
+		return 2;
+	}
+
+	std::string error;
+	WavData input;
+	Timeline timeline;
+
+	if (!wav_read(input_path, input, error) || !load_timeline(timeline_path, timeline, error)) {
+		fprintf(stderr, "%s\n", error.c_str());
+		return 2;
+	}
+
+	if (input.frames == 0) {
+		fprintf(stderr, "%s has no audio\n", input_path.c_str());
+		return 2;
+	}
+
+	// The filter, like OBS, handles at most MAX_AUDIO_CHANNELS planes
+	if (input.channels > MAX_AUDIO_CHANNELS) {
+		fprintf(stderr, "%s has %zu channels, at most %d are supported\n", input_path.c_str(), input.channels,
+			MAX_AUDIO_CHANNELS);
+		return 2;
+	}
+
+	if (input.sample_rate == 0) {
+		fprintf(stderr, "%s has a sample rate of 0\n", input_path.c_str());
+		return 2;
+	}
+
+	if (!obs_startup("en-US", nullptr, nullptr)) {
+		fprintf(stderr, "Couldn't start libobs\n");
+		return 2;
+	}
+
+	WavData output;
+	double elapsed = render(input, timeline, input.channels, output);
+
+	printf("Rendered %zu frames, %zu channels at %u Hz in %.3f ms (%.1fx realtime)\n", input.frames,
+	       input.channels, input.sample_rate, elapsed * 1000.0,
+	       (double)input.frames / input.sample_rate / elapsed);
+
+	int result = 0;
+
+	if (!output_path.empty() && !wav_write(output_path, output, error)) {
+		fprintf(stderr, "%s\n", error.c_str());
+		result = 2;
+	}
+
+	if (!golden_path.empty()) {
+		WavData golden;
+
+		if (!wav_read(golden_path, golden, error)) {
+			fprintf(stderr, "%s\n", error.c_str());
+			result = 2;
+		} else if (!compare(output, golden, tolerance)) {
+			result = 1;
+		}
+	}
+
+	if (run_bench)
+		bench(input, timeline);
+
+	obs_shutdown();
+
+	return result;
+}
@@ -0,0 +1,643 @@
+/*
+Scalability stress test for the Wave Link Sync filter.
+
+Starts a mock Wave Link server in-process, connects WebSocketHandler to it and creates N filters through
+filter_create, spread over a handful of Wave Link channels. Simulated audio threads then run
+filter_handle_audio on every filter back to back while the mock server hammers the client with
+inputVolumeChanged notifications.
+
+For every N it reports:
+  - the time spent inside filter_handle_audio per audio tick (all filters, summed over the audio threads)
+    and per filter, as well as the CPU time per tick of the audio threads and, on Linux, of the client's
+    websocket and worker threads. The mock server's own threads aren't counted.
+  - the memory the filters added
+  - the notification-to-apply latency, from the mock server sending a new volume to the first audio tick
+    of a filter following that channel seeing it
+  - how many of the filters got a slot in the shared-memory state, at most WAVELINK_SYNC_STATE_MAX_FILTERS
+
+Usage:
+  wavelink-sync-stress [--counts 1,10,100,1000] [--threads <audio threads>] [--ticks <ticks per N>]
+                       [--rate <notifications per second>] [--port <mock server port>]
+
+Exports the shared-memory state into a region of its own (/wavelink-sync-state-stress), so it can run next to an OBS
+with the plugin loaded.
+*/
+
+#include <obs.h>
+#include <plugin-support.h>
+
+#include <websocket.hpp>
+
+#include <ixwebsocket/IXWebSocketServer.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+#ifdef __linux__
+#include <dirent.h>
+#include <malloc.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+extern "C" const char *obs_module_text(const char *lookup_string)
+{
+	return lookup_string;
+}
+
+extern void filter_get_defaults(obs_data_t *defaults);
+extern void *filter_create(obs_data_t *settings, obs_source_t *obs_source);
+extern void filter_destroy(void *data);
+extern obs_audio_data *filter_handle_audio(void *data, obs_audio_data *audio);
+
+#define STRESS_CHANNELS 8
+#define STRESS_AUDIO_CHANNELS 2
+#define STRESS_SAMPLE_RATE 48000
+#define STRESS_CONNECT_TIMEOUT_MS 5000
+
+// Small N get through their ticks long before the notifications had a chance to reach them
+#define STRESS_MIN_SECONDS 1.0
+
+// The two volumes every notification alternates between, per channel
+static const int stress_volumes[] = {40, 60};
+
+static std::string get_channel_identifier(int index)
+{
+	return "stress_channel_" + std::to_string(index);
+}
+
+static int64_t get_time_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		       std::chrono::steady_clock::now().time_since_epoch())
+		.count();
+}
+
+// CPU time of the calling thread
+static int64_t get_thread_cpu_ns()
+{
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+		return 0;
+
+	// Both in 100 ns units
+	uint64_t kernel_time = ((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+	uint64_t user_time = ((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime;
+	return (int64_t)(kernel_time + user_time) * 100;
+#else
+	struct timespec time;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) != 0)
+		return 0;
+
+	return (int64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+#endif
+}
+
+// Threads that don't count towards the client's CPU time, the main thread and the ones the mock server runs on
+static std::mutex excluded_threads_mutex;
+static std::set<long> excluded_threads;
+
+static void exclude_current_thread()
+{
+#ifdef __linux__
+	std::lock_guard<std::mutex> lock(excluded_threads_mutex);
+	excluded_threads.insert((long)syscall(SYS_gettid));
+#endif
+}
+
+// CPU time of every thread that isn't excluded, by thread ID. Taken between rounds, when no audio thread is
+// running, that leaves the threads of WebSocketHandler and its websocket. Only Linux exposes other threads' CPU time.
+static std::map<long, int64_t> get_client_cpu_ns()
+{
+	std::map<long, int64_t> cpu_ns;
+
+#ifdef __linux__
+	DIR *tasks = opendir("/proc/self/task");
+	if (!tasks)
+		return cpu_ns;
+
+	std::lock_guard<std::mutex> lock(excluded_threads_mutex);
+
+	while (struct dirent *task = readdir(tasks)) {
+		long tid = atol(task->d_name);
+		if (tid <= 0 || excluded_threads.count(tid))
+			continue;
+
+		// The first field is the time spent on the CPU in ns
+		std::string path = std::string("/proc/self/task/") + task->d_name + "/schedstat";
+		FILE *file = fopen(path.c_str(), "r");
+		if (!file)
+			continue;
+
+		long long ns = 0;
+		if (fscanf(file, "%lld", &ns) == 1)
+			cpu_ns[tid] = ns;
+
+		fclose(file);
+	}
+
+	closedir(tasks);
+#endif
+
+	return cpu_ns;
+}
+
+// Heap in use where glibc can tell, resident memory otherwise (which misses memory freed by an earlier N and reused)
+static size_t get_memory_bytes()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+	struct mallinfo2 info = mallinfo2();
+	return info.uordblks + info.hblkhd;
+#elif defined(__linux__)
+	FILE *file = fopen("/proc/self/statm", "r");
+	if (!file)
+		return 0;
+
+	unsigned long size = 0;
+	unsigned long resident = 0;
+	if (fscanf(file, "%lu %lu", &size, &resident) != 2)
+		resident = 0;
+
+	fclose(file);
+
+	return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+#else
+	return 0;
+#endif
+}
+
+// Volume and send time packed into one word, so readers never see the volume of one send with the time of another
+struct SentVolume {
+	int volume;
+	int64_t ns;
+
+	static uint64_t pack(int volume, int64_t ns) { return ((uint64_t)ns << 8) | (uint64_t)(volume & 0xFF); }
+
+	static SentVolume unpack(uint64_t packed) { return {(int)(packed & 0xFF), (int64_t)(packed >> 8)}; }
+};
+
+// Answers the requests WebSocketHandler sends with STRESS_CHANNELS channels on the local and stream mixers,
+// in whichever encoding the client talks
+class MockServer {
+private:
+	ix::WebSocketServer server;
+	std::atomic<int> codec = MessageCodec::JSON_TEXT;
+
+	// Last volume sent per channel and when (see SentVolume), read by the audio threads to measure the latency
+	std::atomic<uint64_t> sent[STRESS_CHANNELS];
+
+	std::thread hammer_thread;
+	std::atomic<bool> hammer_running = false;
+
+	nlohmann::json getInputConfigs()
+	{
+		nlohmann::json inputs = nlohmann::json::array();
+
+		for (int i = 0; i < STRESS_CHANNELS; i++) {
+			inputs.push_back({{"identifier", get_channel_identifier(i)},
+					  {"name", "Stress " + std::to_string(i)},
+					  {"localMixer", {false, getSent(i).volume}},
+					  {"streamMixer", {false, 100}}});
+		}
+
+		return inputs;
+	}
+
+	nlohmann::json handleRequest(const nlohmann::json &request)
+	{
+		nlohmann::json response = {{"jsonrpc", "2.0"}, {"id", request.value("id", 0)}};
+		std::string method = request.value("method", "");
+
+		if (method == "getInputConfigs") {
+			response["result"] = getInputConfigs();
+		} else if (method == "getOutputConfig") {
+			response["result"] = {{"localMixer", {false, 100}}, {"streamMixer", {false, 100}}};
+		} else if (method == "setInputConfig") {
+			response["result"] = nullptr;
+		} else {
+			response["error"] = {{"code", -32601}, {"message", "Method not found"}};
+		}
+
+		return response;
+	}
+
+	void send(ix::WebSocket &client, const nlohmann::json &json)
+	{
+		if (codec == MessageCodec::MSGPACK) {
+			auto data = nlohmann::json::to_msgpack(json);
+			client.sendBinary(std::string(data.begin(), data.end()));
+		} else if (codec == MessageCodec::CBOR) {
+			auto data = nlohmann::json::to_cbor(json);
+			client.sendBinary(std::string(data.begin(), data.end()));
+		} else {
+			client.sendText(json.dump());
+		}
+	}
+
+	void handleMessage(ix::WebSocket &client, const ix::WebSocketMessagePtr &msg)
+	{
+		exclude_current_thread();
+
+		nlohmann::json json;
+
+		if (msg->binary) {
+			json = nlohmann::json::from_msgpack(msg->str, true, false);
+			codec = MessageCodec::MSGPACK;
+
+			if (json.is_discarded()) {
+				json = nlohmann::json::from_cbor(msg->str, true, false);
+				codec = MessageCodec::CBOR;
+			}
+		} else {
+			json = nlohmann::json::parse(msg->str, nullptr, false);
+			codec = MessageCodec::JSON_TEXT;
+		}
+
+		if (json.is_array()) {
+			nlohmann::json responses = nlohmann::json::array();
+
+			for (auto &request : json)
+				responses.push_back(handleRequest(request));
+
+			send(client, responses);
+		} else if (json.is_object()) {
+			send(client, handleRequest(json));
+		}
+	}
+
+	void hammerLoop(int rate)
+	{
+		exclude_current_thread();
+
+		std::mt19937 random(1824);
+		auto interval = std::chrono::nanoseconds(1000000000 / std::max(rate, 1));
+		auto next = std::chrono::steady_clock::now();
+
+		while (hammer_running) {
+			int channel = (int)(random() % STRESS_CHANNELS);
+			int previous = getSent(channel).volume;
+			int volume = previous == stress_volumes[0] ? stress_volumes[1] : stress_volumes[0];
+
+			nlohmann::json notification = {{"jsonrpc", "2.0"},
+						       {"method", "inputVolumeChanged"},
+						       {"params",
+							{{"identifier", get_channel_identifier(channel)},
+							 {"mixerID", "com.elgato.mix.local"},
+							 {"value", volume}}}};
+
+			sent[channel] = SentVolume::pack(volume, get_time_ns());
+
+			for (auto &client : server.getClients())
+				send(*client, notification);
+
+			next += interval;
+			std::this_thread::sleep_until(next);
+		}
+	}
+
+public:
+	MockServer(int port) : server(port, "127.0.0.1")
+	{
+		for (int i = 0; i < STRESS_CHANNELS; i++)
+			sent[i] = SentVolume::pack(stress_volumes[0], 0);
+	}
+
+	bool start(std::string &error)
+	{
+		server.setOnClientMessageCallback([this](std::shared_ptr<ix::ConnectionState>, ix::WebSocket &client,
+							 const ix::WebSocketMessagePtr &msg) {
+			if (msg->type == ix::WebSocketMessageType::Message)
+				handleMessage(client, msg);
+		});
+
+		auto result = server.listen();
+		if (!result.first) {
+			error = result.second;
+			return false;
+		}
+
+		server.start();
+		return true;
+	}
+
+	void stop() { server.stop(); }
+
+	void startHammer(int rate)
+	{
+		hammer_running = true;
+		hammer_thread = std::thread([this, rate]() { hammerLoop(rate); });
+	}
+
+	void stopHammer()
+	{
+		hammer_running = false;
+
+		if (hammer_thread.joinable())
+			hammer_thread.join();
+	}
+
+	SentVolume getSent(int channel) { return SentVolume::unpack(sent[channel]); }
+};
+
+struct AudioThreadResult {
+	std::vector<int64_t> tick_ns;
+	std::vector<int64_t> latency_ns;
+	int64_t cpu_ns = 0;
+};
+
+// Runs every tick on filters[first, last) like an OBS audio thread would, at least until end_ns
+static void run_audio_thread(MockServer &server, std::vector<filter_t *> &filters, size_t first, size_t last,
+			     size_t ticks, int64_t end_ns, AudioThreadResult &result)
+{
+	std::vector<float> source(AUDIO_OUTPUT_FRAMES);
+	for (size_t i = 0; i < source.size(); i++)
+		source[i] = 0.5f * sinf((float)i * 0.0575f);
+
+	std::vector<std::vector<float>> planes(STRESS_AUDIO_CHANNELS, source);
+	std::vector<int> seen_volume(last - first, -1);
+
+	result.tick_ns.reserve(ticks);
+
+	int64_t cpu_before = get_thread_cpu_ns();
+
+	for (size_t tick = 0; tick < ticks || get_time_ns() < end_ns; tick++) {
+		int64_t tick_ns = 0;
+
+		for (size_t i = first; i < last; i++) {
+			filter_t *filter = filters[i];
+
+			// Refill so repeated gain doesn't drive the buffer into denormals
+			obs_audio_data audio = {};
+			audio.frames = AUDIO_OUTPUT_FRAMES;
+			for (size_t c = 0; c < STRESS_AUDIO_CHANNELS; c++) {
+				memcpy(planes[c].data(), source.data(), source.size() * sizeof(float));
+				audio.data[c] = (uint8_t *)planes[c].data();
+			}
+
+			int64_t before = get_time_ns();
+			filter_handle_audio(filter, &audio);
+			int64_t after = get_time_ns();
+
+			tick_ns += after - before;
+
+			// What the tick applied, looking it up again could see a value the tick didn't get
+			int channel = (int)(i % STRESS_CHANNELS);
+			int volume = filter->channel_volume;
+
+			if (volume != seen_volume[i - first]) {
+				SentVolume sent = server.getSent(channel);
+
+				// The first sighting only establishes the starting point. A send racing the tick
+				// can come out negative, those samples are dropped.
+				if (seen_volume[i - first] != -1 && volume == sent.volume && after >= sent.ns)
+					result.latency_ns.push_back(after - sent.ns);
+
+				seen_volume[i - first] = volume;
+			}
+		}
+
+		result.tick_ns.push_back(tick_ns);
+	}
+
+	result.cpu_ns = get_thread_cpu_ns() - cpu_before;
+}
+
+static int64_t get_percentile(std::vector<int64_t> &values, double percentile)
+{
+	if (values.empty())
+		return 0;
+
+	std::sort(values.begin(), values.end());
+
+	size_t index = std::min(values.size() - 1, (size_t)(percentile * (double)values.size()));
+	return values[index];
+}
+
+static void run_round(MockServer &server, size_t count, size_t threads, size_t ticks, int rate)
+{
+	size_t memory_before = get_memory_bytes();
+
+	std::vector<filter_t *> filters;
+	filters.reserve(count);
+
+	for (size_t i = 0; i < count; i++) {
+		obs_data_t *settings = obs_data_create();
+		filter_get_defaults(settings);
+		obs_data_set_string(settings, "channel", get_channel_identifier((int)(i % STRESS_CHANNELS)).c_str());
+
+		auto filter = (filter_t *)filter_create(settings, nullptr);
+		filter->channels = STRESS_AUDIO_CHANNELS;
+		filter->sample_rate = STRESS_SAMPLE_RATE;
+		filters.push_back(filter);
+
+		obs_data_release(settings);
+	}
+
+	size_t memory_after = get_memory_bytes();
+
+	size_t slots = 0;
+	for (auto filter : filters) {
+		if (filter->shared_state_slot >= 0)
+			slots++;
+	}
+
+	threads = std::max((size_t)1, std::min(threads, count));
+
+	std::vector<AudioThreadResult> results(threads);
+	std::vector<std::thread> audio_threads;
+
+	server.startHammer(rate);
+
+	std::map<long, int64_t> client_cpu_before = get_client_cpu_ns();
+	int64_t end_ns = get_time_ns() + (int64_t)(STRESS_MIN_SECONDS * 1000000000.0);
+
+	for (size_t t = 0; t < threads; t++) {
+		size_t first = count * t / threads;
+		size_t last = count * (t + 1) / threads;
+
+		audio_threads.emplace_back(run_audio_thread, std::ref(server), std::ref(filters), first, last, ticks,
+					   end_ns, std::ref(results[t]));
+	}
+
+	for (auto &thread : audio_threads)
+		thread.join();
+
+	std::map<long, int64_t> client_cpu_after = get_client_cpu_ns();
+
+	server.stopHammer();
+
+	for (auto filter : filters)
+		filter_destroy(filter);
+
+	// Threads may have run a different number of ticks, only the ones all of them ran are compared
+	size_t ran_ticks = 0;
+	ticks = results[0].tick_ns.size();
+
+	for (auto &result : results) {
+		ticks = std::min(ticks, result.tick_ns.size());
+		ran_ticks = std::max(ran_ticks, result.tick_ns.size());
+	}
+
+	// Per tick, summed over the audio threads
+	std::vector<int64_t> tick_ns(ticks, 0);
+	std::vector<int64_t> latency_ns;
+
+	for (auto &result : results) {
+		for (size_t tick = 0; tick < ticks; tick++)
+			tick_ns[tick] += result.tick_ns[tick];
+
+		latency_ns.insert(latency_ns.end(), result.latency_ns.begin(), result.latency_ns.end());
+	}
+
+	int64_t total_ns = 0;
+	for (int64_t ns : tick_ns)
+		total_ns += ns;
+
+	double tick_us = (double)total_ns / (double)ticks / 1000.0;
+	double filter_ns = (double)total_ns / (double)ticks / (double)count;
+	// Audio threads plus whatever the client's threads spent while they ran
+	int64_t cpu_ns = 0;
+	for (auto &result : results)
+		cpu_ns += result.cpu_ns;
+
+	for (auto &[tid, ns] : client_cpu_after) {
+		auto before = client_cpu_before.find(tid);
+		cpu_ns += ns - (before != client_cpu_before.end() ? before->second : 0);
+	}
+
+	double cpu_us = (double)cpu_ns / 1000.0 / (double)ran_ticks;
+	double tick_p99_us = (double)get_percentile(tick_ns, 0.99) / 1000.0;
+	double memory_kb = ((double)memory_after - (double)memory_before) / 1024.0;
+
+	double latency_p50_us = (double)get_percentile(latency_ns, 0.50) / 1000.0;
+	double latency_p99_us = (double)get_percentile(latency_ns, 0.99) / 1000.0;
+	double latency_max_us = latency_ns.empty() ? 0.0 : (double)latency_ns.back() / 1000.0;
+
+	printf("%-6zu %12.2f %12.2f %12.1f %12.2f %12.1f %10.1f %10.1f %10.1f %9zu %9zu\n", count, tick_us,
+	       tick_p99_us, filter_ns, cpu_us, memory_kb, latency_p50_us, latency_p99_us, latency_max_us,
+	       latency_ns.size(), slots);
+}
+
+static bool parse_counts(const std::string &value, std::vector<size_t> &counts)
+{
+	counts.clear();
+
+	size_t start = 0;
+	while (start <= value.size()) {
+		size_t end = value.find(',', start);
+		if (end == std::string::npos)
+			end = value.size();
+
+		long count = atol(value.substr(start, end - start).c_str());
+		if (count <= 0)
+			return false;
+
+		counts.push_back((size_t)count);
+		start = end + 1;
+	}
+
+	return !counts.empty();
+}
+
+static void print_usage()
+{
+	printf("Usage: wavelink-sync-stress [--counts 1,10,100,1000] [--threads <audio threads>] [--ticks <ticks>]\n"
+	       "                            [--rate <notifications per second>] [--port <port>]\n");
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<size_t> counts = {1, 10, 100, 1000};
+	size_t threads = 1;
+	size_t ticks = 1000;
+	int rate = 500;
+	int port = 18240;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+
+		if (arg == "--counts" && has_value) {
+			if (!parse_counts(argv[++i], counts)) {
+				print_usage();
+				return 2;
+			}
+		} else if (arg == "--threads" && has_value) {
+			threads = (size_t)std::max(1, atoi(argv[++i]));
+		} else if (arg == "--ticks" && has_value) {
+			ticks = (size_t)std::max(1, atoi(argv[++i]));
+		} else if (arg == "--rate" && has_value) {
+			rate = std::max(1, atoi(argv[++i]));
+		} else if (arg == "--port" && has_value) {
+			port = atoi(argv[++i]);
+		} else {
+			print_usage();
+			return 2;
+		}
+	}
+
+	if (!obs_startup("en-US", nullptr, nullptr)) {
+		fprintf(stderr, "Couldn't start libobs\n");
+		return 2;
+	}
+
+	ix::initNetSystem();
+
+	exclude_current_thread();
+
+	MockServer server(port);
+	std::string error;
+
+	if (!server.start(error)) {
+		fprintf(stderr, "Couldn't start the mock server on port %d: %s\n", port, error.c_str());
+		obs_shutdown();
+		return 2;
+	}
+
+	WebSocketHandler::initialize("ws://127.0.0.1:" + std::to_string(port), WAVELINK_SYNC_STATE_SHM_NAME "-stress");
+
+	int64_t deadline = get_time_ns() + (int64_t)STRESS_CONNECT_TIMEOUT_MS * 1000000;
+	while (WebSocketHandler::getChannels().size() < STRESS_CHANNELS && get_time_ns() < deadline)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+	int result = 0;
+
+	if (WebSocketHandler::getChannels().size() < STRESS_CHANNELS) {
+		fprintf(stderr, "WebSocketHandler didn't pick up the mock server's state\n");
+		result = 1;
+	} else {
+		printf("%zu audio thread(s), at least %zu ticks of %d frames per N, %d notifications/s over %d "
+		       "channels\n\n",
+		       threads, ticks, AUDIO_OUTPUT_FRAMES, rate, STRESS_CHANNELS);
+		printf("%-6s %12s %12s %12s %12s %12s %10s %10s %10s %9s %9s\n", "N", "us/tick", "p99 us/tick",
+		       "ns/filter", "CPU us/tick", "memory KB", "lat p50", "lat p99", "lat max", "samples",
+		       "shm slots");
+
+		for (size_t count : counts)
+			run_round(server, count, threads, ticks, rate);
+
+		printf("\nLatencies in us, from the mock server sending a volume to an audio tick applying it\n");
+		printf("Only the first %d filters get a shared-memory slot, the rest don't publish levels there\n",
+		       WAVELINK_SYNC_STATE_MAX_FILTERS);
+	}
+
+	WebSocketHandler::shutdown();
+	server.stop();
+
+	obs_shutdown();
+
+	return result;
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Minimal RIFF/WAVE reader and writer for the offline tools.
+// Reads 16/24/32 bit PCM and 32 bit float, always writes 32 bit float.
+
+struct WavData {
+	uint32_t sample_rate = 0;
+	size_t channels = 0;
+	size_t frames = 0;
+
+	// Interleaved samples in the -1.0 to 1.0 range
+	std::vector<float> samples;
+};
+
+#define WAV_FORMAT_PCM 1
+#define WAV_FORMAT_FLOAT 3
+#define WAV_FORMAT_EXTENSIBLE 0xFFFE
+
+static uint32_t wav_read_u32(const uint8_t *data)
+{
+	return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static uint16_t wav_read_u16(const uint8_t *data)
+{
+	return (uint16_t)(data[0] | (data[1] << 8));
+}
+
+static void wav_write_u32(std::ofstream &file, uint32_t value)
+{
+	uint8_t bytes[4] = {(uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24)};
+	file.write((const char *)bytes, sizeof(bytes));
+}
+
+static void wav_write_u16(std::ofstream &file, uint16_t value)
+{
+	uint8_t bytes[2] = {(uint8_t)value, (uint8_t)(value >> 8)};
+	file.write((const char *)bytes, sizeof(bytes));
+}
+
+static bool wav_read(const std::string &path, WavData &wav, std::string &error)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		error = "Couldn't open " + path;
+		return false;
+	}
+
+	std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+	if (data.size() < 12 || memcmp(data.data(), "RIFF", 4) != 0 || memcmp(data.data() + 8, "WAVE", 4) != 0) {
+		error = path + " is not a WAVE file";
+		return false;
+	}
+
+	uint16_t format = 0;
+	uint16_t bits_per_sample = 0;
+	const uint8_t *sample_data = nullptr;
+	size_t sample_data_size = 0;
+
+	size_t offset = 12;
+	while (offset + 8 <= data.size()) {
+		const uint8_t *chunk = data.data() + offset;
+		size_t chunk_size = wav_read_u32(chunk + 4);
+
+		if (offset + 8 + chunk_size > data.size())
+			chunk_size = data.size() - offset - 8;
+
+		if (memcmp(chunk, "fmt ", 4) == 0 && chunk_size >= 16) {
+			format = wav_read_u16(chunk + 8);
+			wav.channels = wav_read_u16(chunk + 10);
+			wav.sample_rate = wav_read_u32(chunk + 12);
+			bits_per_sample = wav_read_u16(chunk + 22);
+
+			// The actual format is in the first two bytes of the sub format GUID
+			if (format == WAV_FORMAT_EXTENSIBLE && chunk_size >= 26)
+				format = wav_read_u16(chunk + 32);
+		} else if (memcmp(chunk, "data", 4) == 0) {
+			sample_data = chunk + 8;
+			sample_data_size = chunk_size;
+		}
+
+		// Chunks are padded to an even size
+		offset += 8 + chunk_size + (chunk_size & 1);
+	}
+
+	if (!sample_data || wav.channels == 0) {
+		error = path + " has no fmt or data chunk";
+		return false;
+	}
+
+	bool is_float = format == WAV_FORMAT_FLOAT && bits_per_sample == 32;
+	bool is_pcm = format == WAV_FORMAT_PCM &&
+		      (bits_per_sample == 16 || bits_per_sample == 24 || bits_per_sample == 32);
+
+	if (!is_float && !is_pcm) {
+		error = path + " has an unsupported sample format";
+		return false;
+	}
+
+	size_t bytes_per_sample = bits_per_sample / 8;
+	wav.frames = sample_data_size / (bytes_per_sample * wav.channels);
+	wav.samples.resize(wav.frames * wav.channels);
+
+	for (size_t i = 0; i < wav.samples.size(); i++) {
+		const uint8_t *sample = sample_data + i * bytes_per_sample;
+
+		if (is_float) {
+			uint32_t bits = wav_read_u32(sample);
+			memcpy(&wav.samples[i], &bits, sizeof(float));
+		} else if (bits_per_sample == 16) {
+			wav.samples[i] = (int16_t)wav_read_u16(sample) / 32768.0f;
+		} else if (bits_per_sample == 24) {
+			int32_t value = (int32_t)(((uint32_t)sample[0] << 8) | ((uint32_t)sample[1] << 16) |
+						  ((uint32_t)sample[2] << 24)) >>
+					8;
+			wav.samples[i] = value / 8388608.0f;
+		} else {
+			wav.samples[i] = (float)((int32_t)wav_read_u32(sample) / 2147483648.0);
+		}
+	}
+
+	return true;
+}
+
+static bool wav_write(const std::string &path, const WavData &wav, std::string &error)
+{
+	std::ofstream file(path, std::ios::binary);
+	if (!file) {
+		error = "Couldn't open " + path + " for writing";
+		return false;
+	}
+
+	uint32_t data_size = (uint32_t)(wav.samples.size() * sizeof(float));
+
+	file.write("RIFF", 4);
+	wav_write_u32(file, 36 + data_size);
+	file.write("WAVE", 4);
+
+	file.write("fmt ", 4);
+	wav_write_u32(file, 16);
+	wav_write_u16(file, WAV_FORMAT_FLOAT);
+	wav_write_u16(file, (uint16_t)wav.channels);
+	wav_write_u32(file, wav.sample_rate);
+	wav_write_u32(file, wav.sample_rate * (uint32_t)(wav.channels * sizeof(float)));
+	wav_write_u16(file, (uint16_t)(wav.channels * sizeof(float)));
+	wav_write_u16(file, 32);
+
+	file.write("data", 4);
+	wav_write_u32(file, data_size);
+
+	for (float sample : wav.samples) {
+		uint32_t bits;
+		memcpy(&bits, &sample, sizeof(float));
+		wav_write_u32(file, bits);
+	}
+
+	if (!file) {
+		error = "Couldn't write " + path;
+		return false;
+	}
+
+	return true;
+}